@@ -189,11 +189,13 @@ void SingingTromboneEditor::buttonClicked(Button* b)
 
 void SingingTromboneEditor::codeDocumentTextInserted(const String& newText, int insertIndex)
 {
+    audioProcessor.lyricsTextInserted(insertIndex, newText.length());
     onLyricsChanged();
 }
 
 void SingingTromboneEditor::codeDocumentTextDeleted(int startIndex, int endIndex)
 {
+    audioProcessor.lyricsTextDeleted(startIndex, endIndex);
     onLyricsChanged();
 }
 
@@ -9,10 +9,41 @@ SingingTromboneProcessor::SingingTromboneProcessor()
     : AudioProcessor(getBusesProperties()),
       parameters(*this)
 {
+    using Control = engine::Engine::Control;
+
+    parameterControls = {
+        { parameters.volume,           Control::Volume          },
+        { parameters.expression,       Control::Expression      },
+        { parameters.envelopeAttack,   Control::EnvelopeAttack  },
+        { parameters.envelopeDecay,    Control::EnvelopeDecay   },
+        { parameters.envelopeSustain,  Control::EnvelopeSustain },
+        { parameters.envelopeRelease,  Control::EnvelopeRelease },
+        { parameters.vibratoIntensity, Control::Vibrato         },
+        { parameters.legatoEnabled,    Control::Legato          }
+    };
+
+    jassert(parameterControls.size() <= maxParameterControls);
+
+    for (auto& pc : parameterControls)
+        pc.parameter->addListener(this);
+
+    updateParameters();
+
+    if (const auto file{ getUserPhonemeInventoryFile() }; file.existsAsFile()) {
+        const auto res{ loadPhonemeInventory(file) };
+
+        if (res.failed())
+            DBG("Unable to load phoneme inventory: " + res.getErrorMessage());
+    }
+
     startTimerHz(30);
 }
 
-SingingTromboneProcessor::~SingingTromboneProcessor() = default;
+SingingTromboneProcessor::~SingingTromboneProcessor()
+{
+    for (auto& pc : parameterControls)
+        pc.parameter->removeListener(this);
+}
 
 void SingingTromboneProcessor::addListener(Listener* listener)
 {
@@ -89,12 +120,19 @@ void SingingTromboneProcessor::changeProgramName(int /* index */, const String&
 void SingingTromboneProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     engine.prepareToPlay((float)sampleRate, samplesPerBlock);
+    setLatencySamples(engine.getLatencySamples());
 }
 
 void SingingTromboneProcessor::releaseResources()
 {
 }
 
+void SingingTromboneProcessor::reset()
+{
+    // Hosts call this to flush the tails, e.g. when jumping in the timeline
+    engine.allNotesOff();
+}
+
 #ifndef JucePlugin_PreferredChannelConfigurations
 
 bool SingingTromboneProcessor::canAddBus([[maybe_unused]] bool isInput) const
@@ -143,18 +181,30 @@ void SingingTromboneProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuf
 
     juce::ScopedNoDenormals noDenormals;
 
+    engine.clearTransportPosition();
+
     if (auto* playHead{ getPlayHead() }) {
         if (auto pos{ playHead->getPosition() }; pos.hasValue()) {
+            const auto ppq{ pos->getPpqPosition() };
+
             if (auto ts{ pos->getTimeInSamples()}; ts.hasValue()) {
-                if (*ts < timeInSamples)
+                // Loops and relocations land on the phrase sung there before, if known
+                const bool jumped{ *ts != nextTimeInSamples && (pos->getIsPlaying() || *ts < timeInSamples) };
+                const bool resolved{ jumped && ppq.hasValue() && engine.seek(*ppq) };
+
+                if (jumped && !resolved && *ts < timeInSamples)
                     engine.rewind();
-                
+
                 timeInSamples = *ts;
-            }    
+                nextTimeInSamples = *ts + buffer.getNumSamples();
+            }
+
+            if (auto bpm{ pos->getBpm() }; pos->getIsPlaying() && ppq.hasValue() && bpm.hasValue() && *ppq >= 0.0)
+                engine.setTransportPosition(*ppq, *bpm / (60.0 * getSampleRate()));
         }
     }
 
-    updateParameters();
+    processParameterChanges(buffer.getNumSamples());
 
     const auto totalNumInputChannels { getTotalNumInputChannels() };
     const auto totalNumOutputChannels{ getTotalNumOutputChannels() };
@@ -164,8 +214,6 @@ void SingingTromboneProcessor::processBlock (AudioBuffer<float>& buffer, MidiBuf
 
     processMidi(midiMessages);
 
-    engine.processLyrics();
-
     float* outL = buffer.getWritePointer(0);
     float* outR = outL;
 
@@ -195,38 +243,39 @@ void SingingTromboneProcessor::processMidi(MidiBuffer& midiMessages)
 
         if (msg.isController()) {
             const float value{ float(msg.getControllerValue()) / 127.0f };
+            const int pos{ msgIter.samplePosition };
 
             switch (msg.getControllerNumber()) {
                 case 1: // Modulation
-                    parameters.vibratoIntensity->setValueNotifyingHost(value);
+                    handleControllerParameter(parameters.vibratoIntensity, value, pos);
                     break;
                 case 7: // Volume
-                    parameters.volume->setValueNotifyingHost(value);
+                    handleControllerParameter(parameters.volume, value, pos);
                     break;
                 case 11:    // Expression
-                    parameters.expression->setValueNotifyingHost(value);
+                    handleControllerParameter(parameters.expression, value, pos);
                     break;
                 case 72:    // Release
-                    parameters.envelopeRelease->setValueNotifyingHost(value);
+                    handleControllerParameter(parameters.envelopeRelease, value, pos);
                     break;
                 case 73:    // Attack
-                    parameters.envelopeAttack->setValueNotifyingHost(value);
+                    handleControllerParameter(parameters.envelopeAttack, value, pos);
                     break;
                 case 80:    // Decay
-                    parameters.envelopeDecay->setValueNotifyingHost(value);
+                    handleControllerParameter(parameters.envelopeDecay, value, pos);
                     break;
                 case 126:   // Mono mode
-                    parameters.legatoEnabled->setValueNotifyingHost(true);
+                    handleControllerParameter(parameters.legatoEnabled, 1.0f, pos);
                     break;
                 case 127:   // Poly mode
-                    parameters.legatoEnabled->setValueNotifyingHost(false);
+                    handleControllerParameter(parameters.legatoEnabled, 0.0f, pos);
                     break;
                 default:
                     break;
             }
         }
 
-        engine.processMidiMessage(msg);
+        engine.scheduleMidiMessage(msg, msgIter.samplePosition);
     }
 }
 
@@ -256,6 +305,7 @@ void SingingTromboneProcessor::setStateInformation (const void* data, int sizeIn
     parameters.deserialize(stream);
 
     lyricsDocument.replaceAllContent(parameters.lyrics);
+    lyricsEdit = {};
     updateLyrics();
     updateParameters();
 
@@ -264,9 +314,33 @@ void SingingTromboneProcessor::setStateInformation (const void* data, int sizeIn
 
 Result SingingTromboneProcessor::updateLyrics()
 {
+    const auto edit{ lyricsEdit };
+    lyricsEdit = {};
+
+    if (edit.pending)
+        return engine.updateLyrics(lyricsDocument.getAllContent(), edit);
+
     return engine.setLyrics(lyricsDocument.getAllContent());
 }
 
+Result SingingTromboneProcessor::loadPhonemeInventory(const File& file)
+{
+    auto inventory{ engine::PhonemeInventory::createDefault() };
+    const auto res{ inventory->loadFromFile(file) };
+
+    if (res.failed())
+        return res;
+
+    return engine.setPhonemeInventory(inventory);
+}
+
+File SingingTromboneProcessor::getUserPhonemeInventoryFile()
+{
+    return File::getSpecialLocation(File::userApplicationDataDirectory)
+        .getChildFile(JucePlugin_Name)
+        .getChildFile("phonemes.json");
+}
+
 engine::Lyrics::Phrase SingingTromboneProcessor::getCurrentLyricsPhrase() const
 {
     return engine.getCurrentPhrase();
@@ -274,21 +348,84 @@ engine::Lyrics::Phrase SingingTromboneProcessor::getCurrentLyricsPhrase() const
 
 void SingingTromboneProcessor::updateParameters()
 {
-    engine.setVolume(parameters.volume->get());
-    engine.setExpression(parameters.expression->get());
-    engine.setEnvelopeAttack(parameters.envelopeAttack->get());
-    engine.setEnvelopeDecay(parameters.envelopeDecay->get());
-    engine.setEnvelopeSustain(parameters.envelopeSustain->get());
-    engine.setEnvelopeRelease(parameters.envelopeRelease->get());
+    // All the values get sent to the engine on the next block
+    changedParameters = (1u << parameterControls.size()) - 1;
+}
 
-    engine.setLegato(parameters.legatoEnabled->get());
-    engine.setVibrato(parameters.vibratoIntensity->get());
+void SingingTromboneProcessor::processParameterChanges(int numSamples)
+{
+    // Unchanged parameters cost a single atomic exchange
+    const uint32 changed{ changedParameters.exchange(0) };
+
+    if (changed == 0)
+        return;
+
+    for (size_t i = 0; i < parameterControls.size(); ++i) {
+        if ((changed & (1u << i)) != 0) {
+            const auto& pc{ parameterControls[i] };
+            // No sample offset is available for host automation, ramp over the block instead
+            engine.scheduleParameterRamp(pc.control, pc.parameter->convertFrom0to1(pc.parameter->getValue()), numSamples);
+        }
+    }
+}
+
+void SingingTromboneProcessor::handleControllerParameter(RangedAudioParameter* parameter, float value, int samplePosition)
+{
+    for (size_t i = 0; i < parameterControls.size(); ++i) {
+        const auto& pc{ parameterControls[i] };
+
+        if (pc.parameter == parameter) {
+            engine.scheduleParameterChange(pc.control, pc.parameter->convertFrom0to1(value), samplePosition);
+
+            // Only the latest value gets reported to the host
+            controllerValues[i] = value;
+            changedControllerValues.fetch_or(1u << i);
+            break;
+        }
+    }
+}
+
+void SingingTromboneProcessor::reportControllerValues()
+{
+    const uint32 changed{ changedControllerValues.exchange(0) };
+
+    if (changed == 0)
+        return;
+
+    reportingControllerValues = true;
+
+    for (size_t i = 0; i < parameterControls.size(); ++i) {
+        if ((changed & (1u << i)) != 0)
+            parameterControls[i].parameter->setValueNotifyingHost(controllerValues[i].load());
+    }
+
+    reportingControllerValues = false;
+}
+
+void SingingTromboneProcessor::parameterValueChanged(int parameterIndex, float)
+{
+    // Values reported back from the MIDI controllers are in the engine already
+    if (reportingControllerValues && MessageManager::existsAndIsCurrentThread())
+        return;
+
+    // This may be called on any thread
+    for (size_t i = 0; i < parameterControls.size(); ++i) {
+        if (parameterControls[i].parameter->getParameterIndex() == parameterIndex) {
+            changedParameters.fetch_or(1u << i);
+            break;
+        }
+    }
+}
+
+void SingingTromboneProcessor::parameterGestureChanged(int, bool)
+{
 }
 
 //==============================================================================
 
 void SingingTromboneProcessor::timerCallback()
 {
+    reportControllerValues();
     engine.performHousekeeping();
 }
 
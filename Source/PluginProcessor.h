@@ -1,12 +1,14 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <array>
 #include <atomic>
 
 #include "PluginParameters.h"
 #include "engine/Engine.h"
 
 class SingingTromboneProcessor : public juce::AudioProcessor,
+                                 private juce::AudioProcessorParameter::Listener,
                                  private juce::Timer
 {
 public:
@@ -26,6 +28,7 @@ public:
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
+    void reset() override;
 
 #ifndef JucePlugin_PreferredChannelConfigurations
     bool canAddBus(bool isInput) const override;
@@ -62,7 +65,23 @@ public:
 
     CodeDocument& getLyricsDocument() { return lyricsDocument; }
 
+    /**
+     * Apply the lyrics document to the engine.
+     * When the document has been edited since the last update, only
+     * the edited phrases get recompiled and the playback position is kept.
+     */
     Result updateLyrics();
+
+    /** Record the lyrics document edits, as reported by the editor. */
+    void lyricsTextInserted(int insertIndex, int length) { lyricsEdit.insert(insertIndex, length); }
+    void lyricsTextDeleted(int startIndex, int endIndex) { lyricsEdit.remove(startIndex, endIndex); }
+
+    /**
+     * Load phonemes from a JSON file on top of the default inventory.
+     * The user inventory is looked up in the application data folder on start-up.
+     */
+    Result loadPhonemeInventory(const File& file);
+    static File getUserPhonemeInventoryFile();
     engine::Lyrics::Phrase getCurrentLyricsPhrase() const;
 
     void updateParameters();
@@ -71,22 +90,60 @@ public:
 
 private:
 
+    // juce::AudioProcessorParameter::Listener
+    void parameterValueChanged(int parameterIndex, float newValue) override;
+    void parameterGestureChanged(int parameterIndex, bool gestureIsStarting) override;
+
     // juce::Timer
     void timerCallback() override;
 
+    /**
+     * Schedule the changed parameters to the engine, this is called on the audio thread.
+     * JUCE does not report where in the block a host automation change happened,
+     * so the engine ramps to the new values over the block.
+     */
+    void processParameterChanges(int numSamples);
+
+    /**
+     * Apply a MIDI controller value to the engine right away.
+     * The host and the editor get notified later on the message thread.
+     */
+    void handleControllerParameter(RangedAudioParameter* parameter, float value, int samplePosition);
+    void reportControllerValues();
+
     static BusesProperties getBusesProperties();
 
     engine::Engine engine{};
     std::atomic<float> processLoad{};
 
     int64 timeInSamples{};
+    int64 nextTimeInSamples{};
 
     ListenerList<Listener> listeners{};
 
     CodeDocument lyricsDocument{};
+    engine::Lyrics::Edit lyricsEdit{};
 
     PluginParameters parameters;
 
+    /* Engine controls driven by the plugin parameters */
+    struct ParameterControl
+    {
+        RangedAudioParameter* parameter{};
+        engine::Engine::Control control{};
+    };
+
+    std::vector<ParameterControl> parameterControls{};
+
+    constexpr static size_t maxParameterControls = 32;
+
+    /* Parameters changed since the last block, one bit per parameterControls entry */
+    std::atomic<uint32> changedParameters{};
+
+    /* Latest normalized values set by the MIDI controllers, waiting to be reported to the host */
+    std::array<std::atomic<float>, maxParameterControls> controllerValues{};
+    std::atomic<uint32> changedControllerValues{};
+    std::atomic<bool> reportingControllerValues{};
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SingingTromboneProcessor)
 };
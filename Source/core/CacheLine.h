@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+namespace core {
+
+/**
+ * Assumed size of the CPU cache line.
+ *
+ * Data written by different threads should be aligned to this size
+ * to avoid false sharing.
+ */
+constexpr static size_t CACHE_LINE_SIZE = 64;
+
+} // namespace core
@@ -67,7 +67,12 @@ struct List
     {
         jassert (item != nullptr);
 
+        item->_prev = nullptr;
         item->_next = _head;
+
+        if (_head != nullptr)
+            _head->_prev = item;
+
         _head = item;
 
         if (_tail == nullptr)
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include "core/CacheLine.h"
+
+namespace core {
+
+/**
+ * @brief Bounded lock-free multiple-producer single-consumer queue.
+ *
+ * Each slot carries a sequence number telling whether it is free to be written
+ * or ready to be read. Producers claim the slots with a compare-and-swap on the
+ * write index, while the consumer owns the read index and never waits on
+ * the producers. The queue holds up to Size elements.
+ *
+ * @note After Dmitry Vyukov's bounded MPMC queue
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+template <typename T, size_t Size>
+class MPSCQueue final
+{
+public:
+
+    static_assert(Size > 1 && (Size & (Size - 1)) == 0, "Queue size must be a power of two");
+
+    MPSCQueue() noexcept
+    {
+        for (size_t i = 0; i < Size; ++i)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator =(const MPSCQueue&) = delete;
+
+    ~MPSCQueue() = default;
+
+    /** This can be called from any thread. */
+    bool send(const T& obj) noexcept
+    {
+        return push(obj);
+    }
+
+    bool send(T&& obj) noexcept
+    {
+        return push(std::move(obj));
+    }
+
+    /** This must be called from the consumer thread only. */
+    bool receive(T& obj) noexcept
+    {
+        Cell& cell{ cells[readIdx & MASK] };
+        const size_t seq{ cell.sequence.load(std::memory_order_acquire) };
+
+        // A producer may have claimed the slot but not published it yet
+        if (seq != readIdx + 1)
+            return false;
+
+        obj = std::move(cell.data);
+        cell.sequence.store(readIdx + Size, std::memory_order_release);
+        ++readIdx;
+
+        return true;
+    }
+
+    /**
+     * Receive up to maxObjs elements, stopping at the first slot not published yet.
+     * Returns the number of elements received.
+     */
+    size_t receiveBatch(T* objs, size_t maxObjs) noexcept
+    {
+        size_t n{};
+
+        while (n < maxObjs && receive(objs[n]))
+            ++n;
+
+        return n;
+    }
+
+private:
+
+    constexpr static size_t MASK = Size - 1;
+
+    template <typename U>
+    bool push(U&& obj) noexcept
+    {
+        size_t pos{ writeIdx.load(std::memory_order_relaxed) };
+
+        for (;;) {
+            Cell& cell{ cells[pos & MASK] };
+            const size_t seq{ cell.sequence.load(std::memory_order_acquire) };
+            const auto diff{ (std::ptrdiff_t)seq - (std::ptrdiff_t)pos };
+
+            if (diff == 0) {
+                if (writeIdx.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::forward<U>(obj);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // The slot has not been consumed yet, queue is full
+                return false;
+            } else {
+                pos = writeIdx.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence{};
+        T data{};
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> writeIdx{ 0 };
+    alignas(CACHE_LINE_SIZE) size_t readIdx{ 0 };
+    alignas(CACHE_LINE_SIZE) Cell cells[Size];
+};
+
+} // namespace core
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <atomic>
+#include <algorithm>
+#include <utility>
+#include "core/CacheLine.h"
 
 namespace core {
 
@@ -8,6 +11,12 @@ namespace core {
  * @brief Simple lock-free ring buffer.
  *
  * This is an implementation of single-producer single-consumer queue.
+ * The queue holds up to Size - 1 elements.
+ *
+ * The producer and consumer indices live on separate cache lines, so that
+ * the two threads do not false-share. Each side keeps a cached copy of the
+ * opposite index, which is only reloaded when the queue looks full (or empty),
+ * so most operations do not touch the other thread's cache line at all.
  *
  * @note From http://www.vitorian.com/x1/archives/370
  * https://github.com/Vitorian/RedditHelp/blob/master/test_spsc_ring.cpp
@@ -17,12 +26,9 @@ class Queue final
 {
 public:
 
-    Queue() noexcept
-        : readIdx {0},
-          writeIdx {0},
-          data {{}}
-    {
-    }
+    static_assert(Size > 1, "Queue must have room for at least one element");
+
+    Queue() noexcept = default;
 
     Queue(const Queue&) = delete;
     Queue& operator =(const Queue&) = delete;
@@ -31,40 +37,137 @@ public:
 
     bool send(const T& obj) noexcept
     {
-        size_t nextIdx = writeIdx + 1 < Size ? writeIdx + 1 : 0;
+        return push(obj);
+    }
+
+    bool send(T&& obj) noexcept
+    {
+        return push(std::move(obj));
+    }
+
+    bool receive(T& obj) noexcept
+    {
+        const size_t readPos{ readIdx.load(std::memory_order_relaxed) };
+
+        if (readPos == cachedWriteIdx) {
+            cachedWriteIdx = writeIdx.load(std::memory_order_acquire);
 
-        if (nextIdx != readIdx) {
-            data[writeIdx] = obj;
-            writeIdx = nextIdx;
-            return true;
+            if (readPos == cachedWriteIdx)
+                return false;
         }
 
-        return false;
+        obj = std::move(data[readPos]);
+        readIdx.store(increment(readPos), std::memory_order_release);
+
+        return true;
     }
 
-    bool receive(T& obj) noexcept
+    /**
+     * Send as many of the elements as there is room for.
+     * Returns the number of elements sent, which get published at once.
+     */
+    size_t sendBatch(const T* objs, size_t numObjs) noexcept
     {
-        size_t nextIdx = readIdx + 1 < Size ? readIdx + 1 : 0;
+        const size_t writePos{ writeIdx.load(std::memory_order_relaxed) };
+        size_t room{ distance(writePos, cachedReadIdx) };
+
+        if (room < numObjs) {
+            cachedReadIdx = readIdx.load(std::memory_order_acquire);
+            room = distance(writePos, cachedReadIdx);
+        }
+
+        const size_t n{ std::min(numObjs, room) };
+        size_t idx{ writePos };
 
-        if (readIdx != writeIdx) {
-            obj = std::move (data[readIdx]);
-            readIdx = nextIdx;
-            return true;
+        for (size_t i = 0; i < n; ++i) {
+            data[idx] = objs[i];
+            idx = increment(idx);
         }
 
-        return false;
+        writeIdx.store(idx, std::memory_order_release);
+
+        return n;
     }
 
+    /**
+     * Receive up to maxObjs elements.
+     * Returns the number of elements received.
+     */
+    size_t receiveBatch(T* objs, size_t maxObjs) noexcept
+    {
+        const size_t readPos{ readIdx.load(std::memory_order_relaxed) };
+        size_t available{ used(cachedWriteIdx, readPos) };
+
+        if (available < maxObjs) {
+            cachedWriteIdx = writeIdx.load(std::memory_order_acquire);
+            available = used(cachedWriteIdx, readPos);
+        }
+
+        const size_t n{ std::min(maxObjs, available) };
+        size_t idx{ readPos };
+
+        for (size_t i = 0; i < n; ++i) {
+            objs[i] = std::move(data[idx]);
+            idx = increment(idx);
+        }
+
+        readIdx.store(idx, std::memory_order_release);
+
+        return n;
+    }
+
+    /** Number of elements in the queue, this is only a snapshot when called concurrently. */
     size_t count() const noexcept
     {
-        return (writeIdx - readIdx) % Size;
+        return used(writeIdx.load(std::memory_order_acquire), readIdx.load(std::memory_order_acquire));
     }
 
 private:
 
-    std::atomic<size_t> readIdx;
-    std::atomic<size_t> writeIdx;
-    T data[Size];
+    template <typename U>
+    bool push(U&& obj) noexcept
+    {
+        const size_t writePos{ writeIdx.load(std::memory_order_relaxed) };
+        const size_t nextIdx{ increment(writePos) };
+
+        if (nextIdx == cachedReadIdx) {
+            cachedReadIdx = readIdx.load(std::memory_order_acquire);
+
+            if (nextIdx == cachedReadIdx)
+                return false;
+        }
+
+        data[writePos] = std::forward<U>(obj);
+        writeIdx.store(nextIdx, std::memory_order_release);
+
+        return true;
+    }
+
+    static size_t increment(size_t idx) noexcept
+    {
+        return idx + 1 < Size ? idx + 1 : 0;
+    }
+
+    static size_t used(size_t writePos, size_t readPos) noexcept
+    {
+        return writePos >= readPos ? writePos - readPos : Size - readPos + writePos;
+    }
+
+    /* Free slots, one slot is always left empty to tell a full queue from an empty one */
+    static size_t distance(size_t writePos, size_t readPos) noexcept
+    {
+        return Size - 1 - used(writePos, readPos);
+    }
+
+    /* Producer side */
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> writeIdx{ 0 };
+    size_t cachedReadIdx{ 0 };
+
+    /* Consumer side */
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> readIdx{ 0 };
+    size_t cachedWriteIdx{ 0 };
+
+    alignas(CACHE_LINE_SIZE) T data[Size]{};
 };
 
 } // namespace core
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include "core/Queue.h"
+
+namespace core {
+
+/**
+ * @brief Deferred reclamation of the objects released by the real-time thread.
+ *
+ * Objects shared with the real-time thread are retired here once the real-time
+ * thread is done with them, and get destroyed later by collect(), called
+ * periodically outside of the real-time thread. Retiring only moves a reference
+ * into a pre-allocated ring, so the real-time thread never frees memory and
+ * never drops the last reference to an object.
+ *
+ * Room is reserved before an object gets handed over to the real-time thread,
+ * so that retiring it later can never fail. When there is too much garbage
+ * waiting to be collected, it is the hand-over that fails instead, outside
+ * of the real-time thread.
+ */
+template <size_t Capacity>
+class Reclaimer final
+{
+public:
+
+    Reclaimer() noexcept = default;
+
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator =(const Reclaimer&) = delete;
+
+    /**
+     * Reserve room for an object about to be handed over to the real-time thread.
+     * Returns false if there is no room left.
+     */
+    bool reserve() noexcept
+    {
+        size_t n{ reserved.load(std::memory_order_relaxed) };
+
+        do {
+            if (n >= Capacity)
+                return false;
+        } while (!reserved.compare_exchange_weak(n, n + 1, std::memory_order_relaxed));
+
+        return true;
+    }
+
+    /** Give the reservation back if the object has not been handed over after all. */
+    void cancel() noexcept
+    {
+        reserved.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Retire an object the real-time thread does not need anymore.
+     * This is real-time safe. Each retired object must have been reserved for.
+     */
+    template <typename T>
+    void retire(std::shared_ptr<T>&& obj) noexcept
+    {
+        if (obj == nullptr)
+            return;
+
+        [[maybe_unused]] const bool sent{ retired.send(std::shared_ptr<const void>(std::move(obj))) };
+        assert(sent);
+    }
+
+    /** Destroy the retired objects. This must be called outside of the real-time thread. */
+    void collect()
+    {
+        std::shared_ptr<const void> obj{};
+
+        while (retired.receive(obj)) {
+            obj.reset();
+            reserved.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+
+    Queue<std::shared_ptr<const void>, Capacity + 1> retired{};
+    std::atomic<size_t> reserved{};
+};
+
+} // namespace core
@@ -0,0 +1,74 @@
+#include "engine/CueIndex.h"
+#include "engine/PhraseTable.h"
+
+namespace engine {
+
+static bool isBefore(const CueIndex::Cue& cue, double position)
+{
+    return cue.position < position;
+}
+
+void CueIndex::add(const Cue& cue)
+{
+    auto it{ std::lower_bound(cues.begin(), cues.end(), cue.position - POSITION_TOLERANCE, isBefore) };
+
+    if (it != cues.end() && it->position <= cue.position + POSITION_TOLERANCE)
+        *it = cue;
+    else
+        cues.insert(it, cue);
+}
+
+void CueIndex::remap(const PhraseTable& table)
+{
+    for (auto& cue : cues) {
+        if (table.isPatchOf(cue.revision)) {
+            cue.phraseIndex = (uint32)table.remapPhraseIndex(cue.revision, cue.phraseIndex);
+            cue.revision = table.getRevision();
+        }
+    }
+}
+
+bool CueIndex::find(double position, size_t& phraseIndex) const
+{
+    return find(position, nullptr, 0, 0, phraseIndex);
+}
+
+bool CueIndex::find(double position, const Cue* recentCues, size_t numRecentCues, uint32 revision, size_t& phraseIndex) const
+{
+    const Cue* next{};
+    const Cue* last{};
+
+    if (!cues.empty()) {
+        const auto it{ std::lower_bound(cues.begin(), cues.end(), position - POSITION_TOLERANCE, isBefore) };
+
+        if (it != cues.end())
+            next = &(*it);
+
+        last = &cues.back();
+    }
+
+    // Recent cues are in recording order, later ones replace the earlier ones at the same position
+    for (size_t i = 0; i < numRecentCues; ++i) {
+        const auto& cue{ recentCues[i] };
+
+        if (cue.revision != revision)
+            continue;
+
+        if (cue.position >= position - POSITION_TOLERANCE
+            && (next == nullptr || cue.position <= next->position + POSITION_TOLERANCE))
+            next = &cue;
+
+        if (last == nullptr || cue.position >= last->position - POSITION_TOLERANCE)
+            last = &cue;
+    }
+
+    if (last == nullptr)
+        return false;
+
+    // Past the last cue the lyrics carry on from the last sung phrase
+    phraseIndex = next != nullptr ? next->phraseIndex : last->phraseIndex + 1;
+
+    return true;
+}
+
+} // namespace engine
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <vector>
+
+namespace engine {
+
+class PhraseTable;
+
+/**
+ * Host timeline positions at which the lyrics phrases have been sung.
+ *
+ * Cues are recorded on the audio thread while the host is playing,
+ * and the index is built out of them outside of the audio thread.
+ * When the transport jumps, the phrase to be sung next is found
+ * with a binary search on the timeline position.
+ */
+class CueIndex final
+{
+public:
+    using Ptr = std::shared_ptr<const CueIndex>;
+
+    /** Cues closer than this are considered to be at the same position. */
+    constexpr static double POSITION_TOLERANCE = 1.0e-3; // [quarter notes]
+
+    struct Cue
+    {
+        double position{};      // [quarter notes]
+        uint32 phraseIndex{};
+        uint32 revision{};      // Phrase table the phrase index refers to
+    };
+
+    /** Add a cue, replacing the one recorded at the same position. */
+    void add(const Cue& cue);
+
+    /** Map the phrase indices onto a patched phrase table. */
+    void remap(const PhraseTable& table);
+
+    void clear() { cues.clear(); }
+    bool isEmpty() const { return cues.empty(); }
+    size_t size() const { return cues.size(); }
+
+    /**
+     * Find the phrase to be sung next from the given position.
+     * Returns false if there are no cues to resolve the position.
+     */
+    bool find(double position, size_t& phraseIndex) const;
+
+    /**
+     * Same as above, also looking at the cues recorded since the index has been built.
+     * Recent cues of another phrase table revision are ignored, the others take
+     * precedence over the indexed ones at the same position.
+     * This does not allocate, so that it can be called from the audio thread.
+     */
+    bool find(double position, const Cue* recentCues, size_t numRecentCues, uint32 revision, size_t& phraseIndex) const;
+
+private:
+    std::vector<Cue> cues{};
+};
+
+} // namespace engine
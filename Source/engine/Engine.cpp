@@ -2,9 +2,48 @@
 
 namespace engine {
 
+namespace {
+
+bool isOlder(const Voice* a, const Voice* b)
+{
+    // Serial numbers may wrap around
+    return b == nullptr || int32(a->getTriggerRecord().serial - b->getTriggerRecord().serial) < 0;
+}
+
+bool haveSamePhrases(const Lyrics& a, const Lyrics& b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].position != b[i].position)
+            return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
 Engine::Engine()
     : voicePool(*this)
 {
+    cachedPhonemeInventory = PhonemeInventory::createDefault();
+
+    cachedPhraseTable = std::make_shared<PhraseTable>(cachedPhonemeInventory);
+    phraseTable = cachedPhraseTable;
+
+    // The initial table and cue index get retired just like the ones sent later
+    cueIndex = std::make_shared<const CueIndex>();
+
+    [[maybe_unused]] const bool reserved{ reclaimer.reserve() && reclaimer.reserve() };
+    jassert(reserved);
+    retiredPhraseTables.reserve(maxRetiredPhraseTables);
+
+    // Voices of the current and the retired banks may be playing at the same time
+    activeVoices.reserve(2 * VoicePool::maxVoicesLimit);
+    scheduledMessages.reserve(scheduledMessagesCapacity);
+
     parameters[PARAM_VOLUME].setValue(1.0f, true);
     parameters[PARAM_EXPRESSION].setValue(1.0f, true);
     parameters[PARAM_VIBRATO].setValue(0.0f, true);
@@ -14,94 +53,245 @@ void Engine::prepareToPlay(float sr, int samplesPerBlock)
 {
     externalSampleRate = sr;
 
-    interpolator.setRatio(INTERNAL_SAMPLE_RATE / externalSampleRate);
+    // Allow for some rounding error in the sample rate reported by the host
+    constexpr float sampleRateTolerance{ 0.5f };
+
+    if (std::abs(externalSampleRate - INTERNAL_SAMPLE_RATE) < sampleRateTolerance)
+        renderMode = RenderMode::Direct;
+    else if (std::abs(externalSampleRate - 2.0f * INTERNAL_SAMPLE_RATE) < sampleRateTolerance)
+        renderMode = RenderMode::HalfBand;
+    else
+        renderMode = RenderMode::Interpolate;
+
+    const float ratio{ INTERNAL_SAMPLE_RATE / externalSampleRate };
+
+    // Whole sub-frames go straight to the host buffer, nothing is left over for the next block
+    const bool rendersAhead{ renderMode != RenderMode::Direct || samplesPerBlock % (int)SUB_FRAME_LENGTH != 0 };
+    midiSchedulingDelay = rendersAhead ? MIDI_SCHEDULING_DELAY : 0;
+
+    interpolator.setRatio(ratio);
     interpolator.reset();
-    remainedSamples = 0;
+    upsampler.reset();
+    halfBandPending = false;
+
+    // Enough sub-frames to cover a whole host block, including the interpolator look-ahead
+    maxSubFrames = (size_t)std::ceil((float(samplesPerBlock) * ratio + 4.0f) / float(SUB_FRAME_LENGTH)) + 1;
+    renderBuffer.setSize((int)NUM_CHANNELS, (int)(maxSubFrames * SUB_FRAME_LENGTH));
+
+    workerPool.resize(numWorkerThreads);
+    workerBuffer.setSize((int)workerPool.getNumThreads(), (int)(maxSubFrames * SUB_FRAME_LENGTH));
+
+    // Resolve the buffer pointers here, the worker threads must not touch the AudioBuffer objects
+    workerOutputs.clear();
 
-    voicePool.prepareToPlay(INTERNAL_SAMPLE_RATE, SUB_FRAME_LENGTH);
+    for (int ch = 0; ch < workerBuffer.getNumChannels(); ++ch)
+        workerOutputs.push_back(workerBuffer.getWritePointer(ch));
+
+    subFrameVibrato.resize(maxSubFrames);
+    gainBuffer.resize(maxSubFrames * SUB_FRAME_LENGTH);
+    renderPosition = 0;
+    renderedSamples = 0;
+    renderTime = 0;
+
+    silentSamples = 0;
+    idleTime = 0.0;
+    idle = false;
+
+    scheduledMessages.clear();
+    nextScheduledMessage = 0;
+
+    // The render time starts over, apply the pending changes right away
+    processParameterChanges(std::numeric_limits<uint64>::max());
+    lastParameterChangeTime = 0;
+
+    voicePool.prepareToPlay();
 
     keysState.reset();
+    sustainedKeys.reset();
     sustained = false;
 }
 
 void Engine::process(float* outL, float* outR, size_t numFrames)
 {
-    float* origOutL{ outL };
-    float* origOutR{ outR };
-    size_t origNumFrames{ numFrames };
-
-    while (numFrames > 0) {
-        if (remainedSamples > 0) {
-            const size_t idx = SUB_FRAME_LENGTH - remainedSamples;
-            const float* subL{ subFrameBuffer.getReadPointer(0, idx) };
-            const float* subR{ subFrameBuffer.getReadPointer(1, idx) };
-
-            while (remainedSamples > 0 && interpolator.canWrite()) {
-                interpolator.write(*subL, *subR);
-                --remainedSamples;
-                subL += 1;
-                subR += 1;
-            }
-
-            while (numFrames > 0 && interpolator.canRead()) {
-                interpolator.read(*outL, *outR);
-                numFrames -= 1;
-                outL += 1;
-                outR += 1;
-            }
-        }
+    // Voices are rendered and resampled on a mono bus,
+    // the result is expanded to stereo at the very end.
+    processCommands();
+    processLyrics();
+    voicePool.update();
+
+    if (canIdle()) {
+        processIdle(outL, outR, numFrames);
+        return;
+    }
+
+    if (idle)
+        resumeFromIdle();
+
+    float* out{ outL };
+    size_t remainingFrames{ numFrames };
+
+    while (remainingFrames > 0) {
+        const size_t produced{ resample(out, remainingFrames) };
+        out += produced;
+        remainingFrames -= produced;
+
+        if (remainingFrames == 0)
+            break;
 
-        if (remainedSamples == 0 && numFrames > 0) {
-            processSubFrame();
-            jassert(remainedSamples > 0);
+        jassert(renderPosition == renderedSamples);
+
+        if (renderMode == RenderMode::Direct && remainingFrames >= SUB_FRAME_LENGTH) {
+            // Whole sub-frames are rendered straight into the host buffer
+            const size_t numSubFrames{ jmin(maxSubFrames, remainingFrames / SUB_FRAME_LENGTH) };
+            render(out, numSubFrames);
+            out += numSubFrames * SUB_FRAME_LENGTH;
+            remainingFrames -= numSubFrames * SUB_FRAME_LENGTH;
+        } else {
+            const size_t numSubFrames{ getNumSubFramesRequired(remainingFrames) };
+            render(renderBuffer.getWritePointer(0), numSubFrames);
+            renderPosition = 0;
+            renderedSamples = numSubFrames * SUB_FRAME_LENGTH;
         }
     }
+
+    if (outR != outL)
+        memcpy(outR, outL, sizeof(float) * numFrames);
 }
 
 void Engine::processMidiMessage(const MidiMessage& msg)
 {
-    if (msg.isNoteOn())
-        noteOn(msg);
-    else if (msg.isNoteOff())
-        noteOff(msg);
-    else if (msg.isController())
-        controlChange(msg);
+    handleMidiMessage(msg, 0);
 }
 
-void Engine::processLyrics()
+void Engine::scheduleMidiMessage(const MidiMessage& msg, int samplePosition)
 {
-    Lyrics::Ptr lyricsPtr{};
-    Lyrics::Ptr ptr{};
+    if (!(msg.isNoteOnOrOff() || msg.isController()))
+        return;
 
-    do {
-        if (lyricsPtr != nullptr)
-            disposeLyricsQueue.send(lyricsPtr);
+    if (scheduledMessages.size() == scheduledMessages.capacity()) {
+        // Never drop the message, note-offs must not get lost
+        jassertfalse;
+        handleMidiMessage(msg, 0);
+        return;
+    }
+
+    const uint64 time{ getScheduledTime(samplePosition) };
+
+    // Keep simultaneous messages in order
+    auto it{ std::upper_bound(scheduledMessages.begin() + (std::ptrdiff_t)nextScheduledMessage, scheduledMessages.end(), time,
+                              [](uint64 t, const ScheduledMessage& m) { return t < m.time; }) };
+
+    double position{ UNKNOWN_POSITION };
+
+    if (transportPosition != UNKNOWN_POSITION)
+        position = transportPosition + (double)jmax(0, samplePosition) * transportRate;
 
-        lyricsPtr = ptr;
-    } while (setLyricsQueue.receive(ptr));
+    scheduledMessages.insert(it, { time, msg, position });
+}
+
+void Engine::scheduleParameterChange(Control control, float value, int samplePosition)
+{
+    // Keep the changes in order, the queue is consumed front to back
+    const uint64 time{ jmax(getScheduledTime(samplePosition), lastParameterChangeTime) };
 
-    if (lyricsPtr == nullptr)
+    if (!parameterChanges.send({ time, control, value })) {
+        jassertfalse;
+        applyParameterChange(control, value);
         return;
+    }
 
-    jassert(lyricsPtr == ptr);
+    lastParameterChangeTime = time;
+}
 
-    size_t numPhrases{ jmin(lyricsPtr->size(), lyricsMaxPhrases) };
+void Engine::scheduleParameterRamp(Control control, float value, int numSamples)
+{
+    const uint64 time{ jmax(getScheduledTime(0), lastParameterChangeTime) };
+    const float ratio{ INTERNAL_SAMPLE_RATE / externalSampleRate };
+    const uint32 rampLength{ (uint32)((float)jmax(0, numSamples) * ratio) };
 
-    for (size_t i = 0; i < numPhrases; ++i) {
-        const auto& phrase{ lyricsPtr->operator[](i) };
+    if (!parameterChanges.send({ time, control, value, rampLength })) {
+        jassertfalse;
+        applyParameterChange(control, value);
+        return;
+    }
+
+    lastParameterChangeTime = time;
+}
+
+uint64 Engine::getScheduledTime(int samplePosition) const
+{
+    // Internal time of the first sample to be output by the next process() call
+    const uint64 readTime{ renderTime - (uint64)(renderedSamples - renderPosition) };
+    const float ratio{ INTERNAL_SAMPLE_RATE / externalSampleRate };
 
-        lyrics[i].parse(phrase.attack, phrase.release);
+    const uint64 time{ readTime + (uint64)((float)jmax(0, samplePosition) * ratio) + midiSchedulingDelay };
+
+    return jmax(time, renderTime);
+}
+
+int Engine::getLatencySamples() const
+{
+    return roundToInt((float)midiSchedulingDelay * externalSampleRate / INTERNAL_SAMPLE_RATE);
+}
+
+void Engine::processLyrics()
+{
+    releaseRetiredPhraseTables();
+
+    // The table can only be replaced when there is room to retire the current one
+    if (pendingPhraseTable == nullptr || retiredPhraseTables.size() == maxRetiredPhraseTables)
+        return;
+
+    size_t index{};
+    const uint32 revision{ phraseTable->getRevision() };
+
+    if (pendingPhraseTable->isPatchOf(revision)) {
+        // Keep the playback position across the edits, including the
+        // ones whose tables got replaced before being adopted
+        index = pendingPhraseTable->remapPhraseIndex(revision, phraseIndex);
+    }
+
+    retiredPhraseTables.push_back(phraseTable);
+    phraseTable = pendingPhraseTable;
+    pendingPhraseTable.reset();
+
+    lyricsNumPhrases = phraseTable->size();
+    phraseIndex = index < lyricsNumPhrases ? index : 0;
+
+    releaseRetiredPhraseTables();
+}
+
+void Engine::releaseRetiredPhraseTables()
+{
+    size_t i{};
+
+    while (i < retiredPhraseTables.size()) {
+        const auto* table{ retiredPhraseTables[i].get() };
+
+        const bool used{ std::any_of(activeVoices.begin(), activeVoices.end(),
+                                     [table](const Voice* voice) { return voice->usesPhraseTable(table); }) };
+
+        if (used) {
+            ++i;
+        } else {
+            reclaimer.retire(std::move(retiredPhraseTables[i]));
+            retiredPhraseTables[i] = retiredPhraseTables.back();
+            retiredPhraseTables.pop_back();
+        }
     }
+}
 
-    lyricsNumPhrases = numPhrases;
-    phraseIndex = 0;
+Result Engine::setMaxVoices(size_t numVoices)
+{
+    if (numVoices == 0 || numVoices > VoicePool::maxVoicesLimit)
+        return Result::fail("Invalid number of voices");
 
-    disposeLyricsQueue.send(lyricsPtr);
+    return sendCommand(ResizeVoicePool{ voicePool.createBank(numVoices) }, true);
 }
 
 Result Engine::setLyrics(const String& str)
 {
-    auto lyricsPtr{ std::make_shared<Lyrics>() };
+    auto lyricsPtr{ std::make_shared<Lyrics>(cachedPhonemeInventory) };
     auto res{ lyricsPtr->parse(str) };
 
     if (res.wasOk()) {
@@ -111,19 +301,198 @@ Result Engine::setLyrics(const String& str)
     return res;
 }
 
-void Engine::rewind()
+Result Engine::updateLyrics(const String& str, const Lyrics::Edit& edit)
+{
+    if (cachedLyrics == nullptr || cachedPhraseTable == nullptr
+        || cachedPhraseTable->getInventoryPtr() != cachedPhonemeInventory) {
+        return setLyrics(str);
+    }
+
+    auto lyricsPtr{ std::make_shared<Lyrics>(cachedPhonemeInventory) };
+    Lyrics::Patch patch{};
+    auto res{ lyricsPtr->parse(*cachedLyrics, str, edit, patch) };
+
+    if (res.failed())
+        return setLyrics(str);
+
+    auto table{ std::make_shared<PhraseTable>(cachedPhonemeInventory) };
+    table->compile(*cachedPhraseTable, *lyricsPtr, patch);
+
+    res = sendPhraseTable(table);
+
+    if (res.wasOk()) {
+        cachedLyrics = lyricsPtr;
+        cachedCueIndex.remap(*table);
+        sendCueIndex();
+    }
+
+    return res;
+}
+
+Result Engine::seekPhrase(size_t index)
+{
+    return sendCommand(SeekPhrase{ index });
+}
+
+Result Engine::allNotesOff()
+{
+    return sendCommand(AllNotesOff{});
+}
+
+Result Engine::sendCommand(Command&& command, bool carriesObject)
+{
+    if (carriesObject && !reclaimer.reserve())
+        return Result::fail("Too many objects waiting to be released");
+
+    if (!commands.send(std::move(command))) {
+        if (carriesObject)
+            reclaimer.cancel();
+
+        return Result::fail("Command queue is full");
+    }
+
+    return Result::ok();
+}
+
+void Engine::processCommands()
+{
+    // Commands sent while draining wait for the next block
+    Command command{};
+
+    for (size_t i = 0; i < commandQueueSize && commands.receive(command); ++i)
+        std::visit([this](auto& cmd) { handleCommand(cmd); }, command);
+}
+
+void Engine::handleCommand(SeekPhrase& command)
+{
+    phraseIndex = command.index < lyricsNumPhrases ? command.index : 0;
+}
+
+void Engine::handleCommand(SetPhraseTable& command)
+{
+    // Only the latest table is kept, it gets swapped in by processLyrics()
+    reclaimer.retire(std::move(pendingPhraseTable));
+    pendingPhraseTable = std::move(command.table);
+}
+
+void Engine::handleCommand(SetCueIndex& command)
 {
-    phraseIndex = 0;
+    reclaimer.retire(std::move(cueIndex));
+    cueIndex = std::move(command.index);
+
+    // Forget the recent cues the new index covers
+    const uint32 firstRecentCue{ recordedCuesCount - (uint32)numRecentCues };
+    const auto numIndexed{ (int32)(command.numCues - firstRecentCue) };
+    const size_t numDropped{ jlimit((size_t)0, numRecentCues, (size_t)jmax(0, numIndexed)) };
+
+    std::copy(recentCues.begin() + (std::ptrdiff_t)numDropped, recentCues.begin() + (std::ptrdiff_t)numRecentCues, recentCues.begin());
+    numRecentCues -= numDropped;
+}
+
+void Engine::handleCommand(ResizeVoicePool& command)
+{
+    voicePool.setPendingBank(std::move(command.bank));
+}
+
+void Engine::handleCommand(AllNotesOff&)
+{
+    stopAllVoices();
+
+    // Notes scheduled for the rest of the block are dropped as well
+    scheduledMessages.clear();
+    nextScheduledMessage = 0;
+
+    sustained = false;
+}
+
+void Engine::setTransportPosition(double position, double quarterNotesPerSample)
+{
+    jassert(position >= 0.0);
+
+    transportPosition = position;
+    transportRate = quarterNotesPerSample;
+}
+
+bool Engine::seek(double position)
+{
+    size_t index{};
+
+    if (lyricsNumPhrases == 0 || !cueIndex->find(position, recentCues.data(), numRecentCues, phraseTable->getRevision(), index))
+        return false;
+
+    phraseIndex = index % lyricsNumPhrases;
+
+    return true;
 }
 
 Result Engine::setLyrics(const Lyrics::Ptr& ptr)
 {
-    if (setLyricsQueue.send(ptr)) {
+    const auto res{ sendPhraseTable(ptr, cachedPhonemeInventory) };
+
+    if (res.wasOk()) {
         cachedLyrics = ptr;
-        return Result::ok();
+
+        // Cues of the previous lyrics are meaningless now
+        cachedCueIndex.clear();
+        sendCueIndex();
     }
 
-    return Result::fail("Queue is full");
+    return res;
+}
+
+Result Engine::setPhonemeInventory(const PhonemeInventory::Ptr& ptr)
+{
+    if (ptr == nullptr)
+        return Result::fail("Invalid phoneme inventory");
+
+    // The current lyrics must be split again, the symbols of
+    // the new inventory may use other non-ASCII characters
+    Lyrics::Ptr lyricsPtr{};
+
+    if (cachedLyrics != nullptr) {
+        lyricsPtr = std::make_shared<Lyrics>(ptr);
+        const auto parseRes{ lyricsPtr->parse(cachedLyrics->getText()) };
+
+        if (parseRes.failed())
+            return parseRes;
+    }
+
+    const auto res{ sendPhraseTable(lyricsPtr, ptr) };
+
+    if (res.wasOk()) {
+        if (lyricsPtr != nullptr && !haveSamePhrases(*lyricsPtr, *cachedLyrics)) {
+            // Cues refer to phrases which do not exist anymore
+            cachedCueIndex.clear();
+            sendCueIndex();
+        }
+
+        cachedLyrics = lyricsPtr;
+        cachedPhonemeInventory = ptr;
+    }
+
+    return res;
+}
+
+Result Engine::sendPhraseTable(const Lyrics::Ptr& lyricsPtr, const PhonemeInventory::Ptr& inventoryPtr)
+{
+    jassert(inventoryPtr != nullptr);
+
+    auto table{ std::make_shared<PhraseTable>(inventoryPtr) };
+
+    if (lyricsPtr != nullptr)
+        table->compile(*lyricsPtr);
+
+    return sendPhraseTable(table);
+}
+
+Result Engine::sendPhraseTable(const std::shared_ptr<PhraseTable>& table)
+{
+    const auto res{ sendCommand(SetPhraseTable{ table }, true) };
+
+    if (res.wasOk())
+        cachedPhraseTable = table;
+
+    return res;
 }
 
 const Lyrics::Phrase& Engine::getCurrentPhrase() const
@@ -146,12 +515,66 @@ const Lyrics::Phrase& Engine::getCurrentPhrase() const
     return dummy;
 }
 
-void Engine::performHousekeeping()
+void Engine::recordCue(const CueIndex::Cue& cue)
 {
-    Lyrics::Ptr ptr{};
+    if (!recordedCuesQueue.send(cue))
+        return;
 
-    while (disposeLyricsQueue.receive(ptr))
-        ptr.reset();
+    ++recordedCuesCount;
+
+    // Only happens when the message thread stalls,
+    // the oldest cues are back with the next index anyway.
+    if (numRecentCues == recentCues.size()) {
+        std::copy(recentCues.begin() + 1, recentCues.end(), recentCues.begin());
+        --numRecentCues;
+    }
+
+    recentCues[numRecentCues++] = cue;
+}
+
+Result Engine::sendCueIndex()
+{
+    const auto res{ sendCommand(SetCueIndex{ std::make_shared<const CueIndex>(cachedCueIndex), receivedCuesCount }, true) };
+
+    if (res.wasOk())
+        indexedCuesCount = receivedCuesCount;
+
+    return res;
+}
+
+void Engine::processCues()
+{
+    CueIndex::Cue cue{};
+
+    while (recordedCuesQueue.receive(cue)) {
+        ++receivedCuesCount;
+
+        if (cachedPhraseTable == nullptr)
+            continue;
+
+        // Cues recorded before the latest edits got adopted are moved onto the
+        // current table, the ones recorded against a replaced table are dropped
+        if (cue.revision != cachedPhraseTable->getRevision()) {
+            if (!cachedPhraseTable->isPatchOf(cue.revision))
+                continue;
+
+            cue.phraseIndex = (uint32)cachedPhraseTable->remapPhraseIndex(cue.revision, cue.phraseIndex);
+            cue.revision = cachedPhraseTable->getRevision();
+        }
+
+        cachedCueIndex.add(cue);
+    }
+
+    // The audio thread resolves the recent cues on its own,
+    // so the index copy is only sent once in a while.
+    if (receivedCuesCount - indexedCuesCount >= (uint32)cueIndexUpdateThreshold)
+        sendCueIndex();
+}
+
+void Engine::performHousekeeping()
+{
+    reclaimer.collect();
+    processCues();
 }
 
 void Engine::updateParameters(size_t numFrames)
@@ -162,7 +585,79 @@ void Engine::updateParameters(size_t numFrames)
     parameters[PARAM_VIBRATO].getNextValue(numFrames);
 }
 
-void Engine::noteOn(const MidiMessage& msg)
+void Engine::handleMidiMessage(const MidiMessage& msg, size_t delay, double position)
+{
+    if (msg.isNoteOn())
+        noteOn(msg, delay, position);
+    else if (msg.isNoteOff())
+        noteOff(msg);
+    else if (msg.isController())
+        controlChange(msg);
+}
+
+void Engine::processScheduledMessages(uint64 endTime)
+{
+    const uint64 startTime{ endTime - SUB_FRAME_LENGTH };
+
+    while (nextScheduledMessage < scheduledMessages.size()) {
+        const auto& scheduled{ scheduledMessages[nextScheduledMessage] };
+
+        if (scheduled.time >= endTime)
+            break;
+
+        const size_t delay{ scheduled.time > startTime ? (size_t)(scheduled.time - startTime) : 0 };
+        handleMidiMessage(scheduled.message, delay, scheduled.position);
+        ++nextScheduledMessage;
+    }
+}
+
+void Engine::processParameterChanges(uint64 endTime)
+{
+    while (parameterChangePending || parameterChanges.receive(nextParameterChange)) {
+        parameterChangePending = true;
+
+        if (nextParameterChange.time >= endTime)
+            break;
+
+        applyParameterChange(nextParameterChange.control, nextParameterChange.value, nextParameterChange.rampLength);
+        parameterChangePending = false;
+    }
+}
+
+void Engine::applyParameterChange(Control control, float value, size_t rampLength)
+{
+    switch (control) {
+    case Control::Volume:
+        parameters[PARAM_VOLUME].rampTo(value, rampLength);
+        break;
+    case Control::Expression:
+        parameters[PARAM_EXPRESSION].rampTo(value, rampLength);
+        break;
+    case Control::Vibrato:
+        parameters[PARAM_VIBRATO].rampTo(value, rampLength);
+        break;
+    case Control::EnvelopeAttack:
+        setEnvelopeAttack(value);
+        break;
+    case Control::EnvelopeDecay:
+        setEnvelopeDecay(value);
+        break;
+    case Control::EnvelopeSustain:
+        setEnvelopeSustain(value);
+        break;
+    case Control::EnvelopeRelease:
+        setEnvelopeRelease(value);
+        break;
+    case Control::Legato:
+        setLegato(value >= 0.5f);
+        break;
+    default:
+        jassertfalse;
+        break;
+    }
+}
+
+void Engine::noteOn(const MidiMessage& msg, size_t delay, double position)
 {
     keysState.set(msg.getNoteNumber());
 
@@ -181,111 +676,496 @@ void Engine::noteOn(const MidiMessage& msg)
     trigger.envelope.decay = envelopeDecay;
     trigger.envelope.sustain = envelopeSustain;
     trigger.envelope.release = envelopeRelease;
+    trigger.serial = noteSerial++;
+    trigger.delay = delay;
+
+    trigger.phrase = (*phraseTable)[phraseIndex];
+
+    if (position != UNKNOWN_POSITION)
+        recordCue({ position, (uint32)phraseIndex.load(), phraseTable->getRevision() });
 
-    trigger.phrase = lyrics[phraseIndex];
     phraseIndex = (phraseIndex + 1) % lyricsNumPhrases;
 
     bool triggered{ false };
 
     if (legato) {
-        if (auto* voice{ activeVoices.first() }) {
-            voice->retrigger(trigger);
+        // Keep retriggering the same voice until it is over
+        if (legatoVoice == nullptr)
+            legatoVoice = findOldestVoice();
+
+        if (legatoVoice != nullptr) {
+            legatoVoice->retrigger(trigger);
+            keyIndex.update(legatoVoice);
             triggered = true;
         }
     }
 
     if (!triggered) {
         if (auto* voice{ voicePool.trigger(trigger) }) {
-            activeVoices.append(voice);
+            activeVoices.push_back(voice);
+            keyIndex.add(voice, voice->getKey());
+        } else if (auto* stolenVoice{ findVoiceToSteal(trigger.key) }) {
+            stolenVoice->steal(trigger);
+            keyIndex.update(stolenVoice);
+            ++stolenNotesCount;
+        } else {
+            ++droppedNotesCount;
         }
     }
+
+    activeVoicesChanged = true;
 }
 
 void Engine::noteOff(const MidiMessage& msg)
 {
-    keysState.reset(msg.getNoteNumber());
+    const int key{ msg.getNoteNumber() };
 
-    if (sustained)
-        return;
+    keysState.reset(key);
 
-    auto* voice{ activeVoices.first() };
+    if (sustained) {
+        sustainedKeys.set(key);
+        return;
+    }
 
-    while (voice != nullptr) {
-        if (voice->getTriggerRecord().key == msg.getNoteNumber())
-            voice->release();
+    for (auto* voice{ keyIndex.first(key) }; voice != nullptr; voice = VoiceKeyIndex::next(voice))
+        voice->release();
 
-        voice = voice->next();
-    }
+    activeVoicesChanged = true;
 }
 
 void Engine::controlChange(const MidiMessage& msg)
 {
     constexpr int CC_SUSTAIN = 64;
+    constexpr int CC_ALL_SOUND_OFF = 120;
+    constexpr int CC_ALL_NOTES_OFF = 123;
 
-    if (msg.getControllerNumber() == CC_SUSTAIN) {
+    switch (msg.getControllerNumber()) {
+    case CC_SUSTAIN: {
         bool wasSustained{ sustained };
         sustained = msg.getControllerValue() > 63;
 
         if (wasSustained && (!sustained)) {
             releaseSustainedVoices();
         }
+
+        break;
+    }
+    case CC_ALL_SOUND_OFF:
+        stopAllVoices();
+        break;
+    case CC_ALL_NOTES_OFF:
+        releaseAllVoices();
+        break;
+    default:
+        break;
     }
 }
 
 void Engine::releaseSustainedVoices()
 {
-    auto* voice{ activeVoices.first() };
+    for (int key = 0; key < VoiceKeyIndex::NUM_KEYS; ++key) {
+        if (!sustainedKeys[key] || keysState[key])
+            continue;
 
-    while (voice != nullptr) {
-        if (!keysState[voice->getTriggerRecord().key])
+        for (auto* voice{ keyIndex.first(key) }; voice != nullptr; voice = VoiceKeyIndex::next(voice))
             voice->release();
+    }
+
+    sustainedKeys.reset();
+    activeVoicesChanged = true;
+}
 
-        voice = voice->next();
+void Engine::releaseAllVoices()
+{
+    // Sustained keys get released as well
+    for (auto* voice : activeVoices) {
+        if (voice->getArticulation() != Voice::Articulation::Release)
+            voice->release();
     }
+
+    keysState.reset();
+    sustainedKeys.reset();
+    activeVoicesChanged = true;
 }
 
-void Engine::processSubFrame()
+void Engine::stopAllVoices()
 {
-    updateParameters(SUB_FRAME_LENGTH);
+    // Voices are cut without fading out
+    for (auto* voice : activeVoices) {
+        keyIndex.remove(voice);
+        voicePool.recycle(voice);
+    }
 
-    subFrameBuffer.clear();
-    mixBuffer.clear();
+    activeVoices.clear();
+    legatoVoice = nullptr;
 
-    float* outL{ subFrameBuffer.getWritePointer(0) };
-    float* outR{ subFrameBuffer.getWritePointer(1) };
+    keysState.reset();
+    sustainedKeys.reset();
+}
+
+Voice* Engine::findVoiceToSteal(int key)
+{
+    const auto policy{ voiceStealing.load() };
+
+    if (policy == VoiceStealing::Off)
+        return nullptr;
+
+    Voice* oldest{};
+    Voice* oldestReleasing{};
+    Voice* quietest{};
+    Voice* sameKey{};
+
+    for (auto* voice : activeVoices) {
+        // Voices already being stolen are fading out
+        if (voice->isStealing())
+            continue;
+
+        if (isOlder(voice, oldest))
+            oldest = voice;
+
+        if (voice->isReleasing() && isOlder(voice, oldestReleasing))
+            oldestReleasing = voice;
+
+        if (quietest == nullptr || voice->getLevel() < quietest->getLevel())
+            quietest = voice;
+
+        if (voice->getKey() == key && isOlder(voice, sameKey))
+            sameKey = voice;
+    }
+
+    switch (policy) {
+    case VoiceStealing::Oldest:
+        return oldest;
+    case VoiceStealing::Quietest:
+        return quietest;
+    case VoiceStealing::ReleasingFirst:
+        return oldestReleasing != nullptr ? oldestReleasing : oldest;
+    case VoiceStealing::SameKey:
+        return sameKey != nullptr ? sameKey : oldest;
+    default:
+        break;
+    }
 
-    auto* voice{ activeVoices.first() };
+    return nullptr;
+}
 
-    while (voice != nullptr) {
-        float* mixL{ mixBuffer.getWritePointer(0) };
-        float* mixR{ mixBuffer.getWritePointer(1) };
-        voice->process(mixL, mixR, SUB_FRAME_LENGTH);
+Voice* Engine::findOldestVoice() const
+{
+    Voice* oldest{};
 
-        for (size_t i = 0; i < SUB_FRAME_LENGTH; ++i) {
-            outL[i] += mixL[i];
-            outR[i] += mixR[i];
+    for (auto* voice : activeVoices) {
+        if (isOlder(voice, oldest))
+            oldest = voice;
+    }
+
+    return oldest;
+}
+
+void Engine::sortActiveVoices()
+{
+    // Voices moving on to the next articulation on their own keep their place
+    // until the next change, the grouping only helps the cache.
+    if (!activeVoicesChanged)
+        return;
+
+    activeVoicesChanged = false;
+
+    auto isBefore = [](const Voice* a, const Voice* b) {
+        const auto artA{ a->getArticulation() };
+        const auto artB{ b->getArticulation() };
+        return artA < artB || (artA == artB && std::less<const Voice*>{}(a, b));
+    };
+
+    // Insertion sort, the order rarely changes between the blocks
+    // so that the voices are mostly sorted already.
+    for (size_t i = 1; i < activeVoices.size(); ++i) {
+        auto* voice{ activeVoices[i] };
+        size_t j{ i };
+
+        while (j > 0 && isBefore(voice, activeVoices[j - 1])) {
+            activeVoices[j] = activeVoices[j - 1];
+            --j;
+        }
+
+        activeVoices[j] = voice;
+    }
+}
+
+bool Engine::canIdle() const
+{
+    // The samples still buffered and the resampler history must be silent as well
+    return activeVoices.empty() && nextScheduledMessage == scheduledMessages.size()
+        && silentSamples >= renderedSamples - renderPosition + IDLE_FLUSH_LENGTH;
+}
+
+void Engine::processIdle(float* outL, float* outR, size_t numFrames)
+{
+    idle = true;
+
+    FloatVectorOperations::clear(outL, (int)numFrames);
+
+    if (outR != outL)
+        FloatVectorOperations::clear(outR, (int)numFrames);
+
+    // Advance the internal time as if the block had been rendered,
+    // the samples still buffered are consumed first.
+    idleTime += (double)numFrames * (double)INTERNAL_SAMPLE_RATE / (double)externalSampleRate;
+    const auto elapsed{ (size_t)idleTime };
+    idleTime -= (double)elapsed;
+
+    const size_t buffered{ renderedSamples - renderPosition };
+
+    if (elapsed <= buffered) {
+        renderPosition += elapsed;
+    } else {
+        // Skip whole sub-frames, so that the notes keep their place on the sub-frame grid
+        const size_t skipped{ elapsed - buffered };
+        const size_t numSubFrames{ (skipped + SUB_FRAME_LENGTH - 1) / SUB_FRAME_LENGTH };
+
+        renderTime += numSubFrames * SUB_FRAME_LENGTH;
+        renderedSamples = numSubFrames * SUB_FRAME_LENGTH - skipped;
+        renderPosition = 0;
+
+        FloatVectorOperations::clear(renderBuffer.getWritePointer(0), (int)renderedSamples);
+    }
+
+    silentSamples += elapsed;
+
+    processParameterChanges(renderTime);
+}
+
+void Engine::resumeFromIdle()
+{
+    idle = false;
+
+    // Nothing has been pushed through the resampler while idle,
+    // half of the last skipped sample may have been output already.
+    interpolator.reset();
+    upsampler.reset();
+    halfBandSample = 0.0f;
+    halfBandPending = renderMode == RenderMode::HalfBand && idleTime >= 0.5;
+    idleTime = 0.0;
+
+    // Whatever smoothing was due has elapsed in silence
+    for (size_t i = 0; i < parameters.size(); ++i) {
+        auto& param{ parameters[i] };
+        param.setValue(param.getTargetValue(), true);
+    }
+}
+
+size_t Engine::getNumSubFramesRequired(size_t numFrames) const
+{
+    size_t numSamples{};
+
+    switch (renderMode) {
+    case RenderMode::Direct:
+        numSamples = numFrames;
+        break;
+    case RenderMode::HalfBand:
+        numSamples = (numFrames + 1) / 2;
+        break;
+    case RenderMode::Interpolate:
+    default:
+        numSamples = interpolator.getNumInputsRequired(numFrames);
+        break;
+    }
+
+    const size_t numSubFrames{ (numSamples + SUB_FRAME_LENGTH - 1) / SUB_FRAME_LENGTH };
+
+    return jlimit((size_t)1, maxSubFrames, numSubFrames);
+}
+
+void Engine::render(float* out, size_t numSubFrames)
+{
+    jassert(numSubFrames > 0 && numSubFrames <= maxSubFrames);
+
+    const size_t numSamples{ numSubFrames * SUB_FRAME_LENGTH };
+
+    FloatVectorOperations::clear(out, (int)numSamples);
+
+    // Voices are rendered over the runs of sub-frames between the scheduled events
+    size_t k{};
+
+    while (k < numSubFrames) {
+        const uint64 subFrameTime{ renderTime + k * SUB_FRAME_LENGTH };
+        processParameterChanges(subFrameTime + SUB_FRAME_LENGTH);
+        processScheduledMessages(subFrameTime + SUB_FRAME_LENGTH);
+
+        size_t n{ numSubFrames - k };
+
+        if (nextScheduledMessage < scheduledMessages.size()) {
+            const uint64 nextTime{ scheduledMessages[nextScheduledMessage].time };
+            n = jmin(n, (size_t)((nextTime - subFrameTime) / SUB_FRAME_LENGTH));
+        }
+
+        if (parameterChangePending)
+            n = jmin(n, (size_t)((nextParameterChange.time - subFrameTime) / SUB_FRAME_LENGTH));
+
+        jassert(n > 0);
+
+        // Advance control-rate parameters up-front, so that all the voices
+        // see the same values for every sub-frame.
+        for (size_t j = k; j < k + n; ++j) {
+            updateParameters(SUB_FRAME_LENGTH);
+            subFrameVibrato[j] = parameters[PARAM_VIBRATO].getCurrentValue();
         }
 
+        if (activeVoices.empty())
+            silentSamples += n * SUB_FRAME_LENGTH;
+        else
+            silentSamples = 0;
+
+        renderVoices(out, k, n);
+        recycleVoices();
+
+        applyGain(out + k * SUB_FRAME_LENGTH, n * SUB_FRAME_LENGTH);
+
+        k += n;
+    }
+
+    // Drop the messages applied, this does not reallocate
+    scheduledMessages.erase(scheduledMessages.begin(), scheduledMessages.begin() + (std::ptrdiff_t)nextScheduledMessage);
+    nextScheduledMessage = 0;
+
+    renderTime += numSamples;
+}
+
+void Engine::applyGain(float* out, size_t numSamples)
+{
+    // Apply volume and expression
+    auto& expression{ parameters[PARAM_EXPRESSION] };
+
+    if (expression.isSmoothing()) {
+        float* gain{ gainBuffer.data() };
+        expression.getNextValues(gain, numSamples);
+
+        FloatVectorOperations::multiply(gain, gain, (int)numSamples);
+        FloatVectorOperations::add(gain, 0.1f, (int)numSamples);
+        FloatVectorOperations::multiply(gain, 1.0f / 1.1f, (int)numSamples);
+        FloatVectorOperations::multiply(out, gain, (int)numSamples);
+    } else {
+        const float e{ expression.getCurrentValue() };
+        const float gain{ (0.1f + e * e) / 1.1f };
+
+        if (gain != 1.0f)
+            FloatVectorOperations::multiply(out, gain, (int)numSamples);
+    }
+
+    parameters[PARAM_VOLUME].applyGain(out, numSamples);
+}
+
+void Engine::renderVoices(float* out, size_t firstSubFrame, size_t numSubFrames)
+{
+    sortActiveVoices();
+
+    const size_t offset{ firstSubFrame * SUB_FRAME_LENGTH };
+    const size_t numSamples{ numSubFrames * SUB_FRAME_LENGTH };
+
+    if (workerPool.getNumThreads() > 0 && activeVoices.size() >= MIN_VOICES_FOR_PARALLEL_RENDERING) {
+        jassert(workerOutputs.size() == workerPool.getNumThreads());
+
+        for (auto* workerOut : workerOutputs)
+            FloatVectorOperations::clear(workerOut + offset, (int)numSamples);
+
+        workerPool.run(activeVoices.size(), [&](size_t job, size_t worker) {
+            renderVoice(*activeVoices[job], worker == 0 ? out : workerOutputs[worker - 1], firstSubFrame, numSubFrames);
+        });
+
+        for (auto* workerOut : workerOutputs)
+            FloatVectorOperations::add(out + offset, workerOut + offset, (int)numSamples);
+    } else if (renderStrategy.load() == RenderStrategy::SubFrameMajor) {
+        for (size_t k = firstSubFrame; k < firstSubFrame + numSubFrames; ++k) {
+            for (auto* voice : activeVoices)
+                renderVoice(*voice, out, k, 1);
+        }
+    } else {
+        for (auto* voice : activeVoices)
+            renderVoice(*voice, out, firstSubFrame, numSubFrames);
+    }
+}
+
+void Engine::renderVoice(Voice& voice, float* out, size_t firstSubFrame, size_t numSubFrames)
+{
+    // Render the entire run of sub-frames with the same voice to keep its state in cache.
+    // Voices accumulate directly into the mix.
+    for (size_t k = firstSubFrame; k < firstSubFrame + numSubFrames && !voice.isOver(); ++k)
+        voice.process(out + k * SUB_FRAME_LENGTH, SUB_FRAME_LENGTH, subFrameVibrato[k]);
+}
+
+void Engine::recycleVoices()
+{
+    size_t i{};
+
+    while (i < activeVoices.size()) {
+        auto* voice{ activeVoices[i] };
+
         if (voice->isOver()) {
-            auto* nextVoice{ activeVoices.removeAndReturnNext(voice) };
+            if (voice == legatoVoice)
+                legatoVoice = nullptr;
+
+            keyIndex.remove(voice);
             voicePool.recycle(voice);
-            voice = nextVoice;
+            activeVoices[i] = activeVoices.back();
+            activeVoices.pop_back();
+            activeVoicesChanged = true;
         } else {
-            voice = voice->next();
+            ++i;
         }
     }
+}
 
-    // Apply volume and expression
-    for (size_t i = 0; i < SUB_FRAME_LENGTH; ++i) {
-        const float volume{ parameters[PARAM_VOLUME].getNextValue() };
-        const float expression{ parameters[Engine::PARAM_EXPRESSION].getNextValue() };
-        const float gain{ volume * (0.1f + expression * expression) / 1.1f };
+size_t Engine::resample(float* out, size_t numFrames)
+{
+    const float* in{ renderBuffer.getReadPointer(0, (int)renderPosition) };
+    const size_t available{ renderedSamples - renderPosition };
+
+    size_t consumed{};
+    size_t produced{};
+
+    switch (renderMode) {
+    case RenderMode::Direct:
+        consumed = produced = jmin(available, numFrames);
+        memcpy(out, in, sizeof(float) * produced);
+        break;
+
+    case RenderMode::HalfBand: {
+        if (halfBandPending) {
+            out[produced++] = halfBandSample;
+            halfBandPending = false;
+        }
+
+        consumed = jmin(available, (numFrames - produced) / 2);
+        upsampler.process(in, out + produced, consumed);
+        produced += 2 * consumed;
+
+        if (produced < numFrames && consumed < available) {
+            // Odd number of frames requested, keep the second half for the next time
+            float pair[2]{};
+            upsampler.process(in + consumed, pair, 1);
+            out[produced++] = pair[0];
+            halfBandSample = pair[1];
+            halfBandPending = true;
+            ++consumed;
+        }
 
-        outL[i] *= gain;
-        outR[i] *= gain;
+        break;
     }
 
-    remainedSamples = SUB_FRAME_LENGTH;
+    case RenderMode::Interpolate:
+    default: {
+        const float* const ins[NUM_CHANNELS]{ in };
+        float* const outs[NUM_CHANNELS]{ out };
+
+        const auto count{ interpolator.process(ins, available, outs, numFrames) };
+        consumed = count.consumed;
+        produced = count.produced;
+        break;
+    }
+    }
+
+    renderPosition += consumed;
+
+    return produced;
 }
 
 } // namespace engine
@@ -1,12 +1,22 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <array>
 #include <bitset>
+#include <functional>
+#include <variant>
 #include "core/Queue.h"
+#include "core/MPSCQueue.h"
+#include "core/Reclaimer.h"
 #include "engine/Interpolator.h"
+#include "engine/HalfBandUpsampler.h"
 #include "engine/Parameter.h"
 #include "engine/Voice.h"
 #include "engine/Lyrics.h"
+#include "engine/PhonemeInventory.h"
+#include "engine/PhraseTable.h"
+#include "engine/CueIndex.h"
+#include "engine/WorkerPool.h"
 
 namespace engine {
 
@@ -23,18 +33,77 @@ public:
     constexpr static float INTERNAL_SAMPLE_RATE_R = 1.0f / INTERNAL_SAMPLE_RATE;
 
     /**
-     * The vocal model produces monophonic audio. However individual voice
-     * processing is in stereo, in case there is any effect applied to the voice. 
+     * The vocal model produces monophonic audio. Voices are mixed and resampled
+     * on a mono bus, which gets expanded to stereo only at the output stage.
      */
-    constexpr static size_t NUM_CHANNELS = 2;
+    constexpr static size_t NUM_CHANNELS = 1;
 
     /**
-     * Processing is subdivided into smaller frames that get passed
-     * via the interpolator to match the internal smaple rate with the one
-     * imposed by the host.
+     * Voices are updated at control rate, once per sub-frame.
+     * Each voice renders all the sub-frames required by the host block
+     * before the next voice starts, then the mix gets resampled to match
+     * the sample rate imposed by the host.
      */
     constexpr static size_t SUB_FRAME_LENGTH = 32;
 
+    /**
+     * MIDI events scheduled with the host block get delayed by this amount
+     * of internal samples, so that they never fall into the samples rendered
+     * ahead by the previous block. The voices are rendered in sub-frames, but a
+     * new voice gets its output delayed to start on the exact sample.
+     *
+     * Nothing is rendered ahead in direct mode when the host blocks are made
+     * of whole sub-frames, the events are then not delayed at all.
+     * See getLatencySamples().
+     */
+    constexpr static size_t MIDI_SCHEDULING_DELAY = SUB_FRAME_LENGTH;
+
+    /**
+     * Voices are rendered on the worker pool only when there are
+     * enough of them to outweigh the synchronisation overhead.
+     */
+    constexpr static size_t MIN_VOICES_FOR_PARALLEL_RENDERING = 4;
+
+    /**
+     * With no voice playing, the engine goes idle once this many silent
+     * samples have been pushed through the resampler, which is longer than
+     * the resampler histories. Idle blocks are zero-filled without rendering.
+     */
+    constexpr static size_t IDLE_FLUSH_LENGTH = SUB_FRAME_LENGTH;
+
+    /**
+     * Output rendering mode, selected in prepareToPlay() based on
+     * the ratio between the internal and the host sample rates.
+     */
+    enum class RenderMode
+    {
+        Direct,         // Host rate matches the internal one, no resampling
+        HalfBand,       // Host rate is exactly twice the internal one
+        Interpolate     // Any other ratio, uses Lagrange interpolator
+    };
+
+    /**
+     * Order in which the voices get rendered over a run of sub-frames.
+     * The worker pool always renders voice-major.
+     */
+    enum class RenderStrategy
+    {
+        VoiceMajor,     // Each voice renders the whole run before the next one, its state stays in cache
+        SubFrameMajor   // All the voices render a sub-frame before moving to the next one
+    };
+
+    /**
+     * Policy used to pick a voice to steal when the voice pool is exhausted.
+     */
+    enum class VoiceStealing
+    {
+        Off,            // Drop the new note
+        Oldest,         // Steal the voice triggered first
+        Quietest,       // Steal the voice with the lowest envelope level
+        ReleasingFirst, // Steal the oldest releasing voice, or the oldest one if none is releasing
+        SameKey         // Steal a voice playing the same key, or the oldest one otherwise
+    };
+
     enum Param
     {
         PARAM_VOLUME,
@@ -44,21 +113,148 @@ public:
         TOTAL_PARAMETERS
     };
 
+    /** Controls that can be changed with scheduleParameterChange(). */
+    enum class Control
+    {
+        Volume,
+        Expression,
+        Vibrato,
+        EnvelopeAttack,
+        EnvelopeDecay,
+        EnvelopeSustain,
+        EnvelopeRelease,
+        Legato,
+
+        NumControls
+    };
+
     Engine();
 
     void prepareToPlay(float sampleRate, int samplesPerBlock);
 
+    /**
+     * Set the number of additional threads used for voices rendering.
+     * Zero (the default) means all the voices are rendered on the audio thread.
+     * Each engine owns its own pool, so this is opt-in: hosts already spread
+     * plugin instances over the available cores.
+     * This takes effect on the next prepareToPlay() call.
+     */
+    void setNumWorkerThreads(size_t n) { numWorkerThreads = n; }
+    size_t getNumWorkerThreads() const { return numWorkerThreads; }
+
     void process(float* outL, float* outR, size_t numFrames);
+
+    /** Apply the MIDI message immediately. */
     void processMidiMessage(const MidiMessage& msg);
-    void processLyrics();
+
+    /**
+     * Schedule the MIDI message to be applied at the given sample
+     * position of the next process() block.
+     */
+    void scheduleMidiMessage(const MidiMessage& msg, int samplePosition);
+
+    /**
+     * Schedule a control change to be applied at the given sample
+     * position of the next process() block. Changes are applied on the
+     * sub-frame they fall into, and must be scheduled in time order.
+     * This must be called from the audio thread.
+     */
+    void scheduleParameterChange(Control control, float value, int samplePosition);
+
+    /**
+     * Schedule a control change that ramps linearly from the current value
+     * over the given number of samples, starting with the next process() block.
+     * This must be called from the audio thread.
+     *
+     * Host automation reaches the plugin through JUCE parameter callbacks,
+     * which carry no sample position. Ramping over the block to the value
+     * seen at its start turns the per-block values into a continuous curve,
+     * one block late. Only volume, expression and vibrato ramp, the other
+     * controls are read on note start and change at the start of the block.
+     */
+    void scheduleParameterRamp(Control control, float value, int numSamples);
 
     float getExternalSampleRate() const { return externalSampleRate; }
+    RenderMode getRenderMode() const { return renderMode; }
+
+    void setRenderStrategy(RenderStrategy s) { renderStrategy = s; }
+    RenderStrategy getRenderStrategy() const { return renderStrategy.load(); }
+
+    /**
+     * Delay of the scheduled MIDI events, in host samples.
+     * This is to be reported to the host, so that it can compensate for it.
+     * It only changes in prepareToPlay().
+     */
+    int getLatencySamples() const;
 
     int getVoiceCount() const { return voicePool.getVoiceCount(); }
 
+    /**
+     * Change the voice pool size.
+     * This must be called outside of the audio thread, the new pool
+     * is swapped in at the beginning of the next processing block.
+     */
+    Result setMaxVoices(size_t numVoices);
+    size_t getMaxVoices() const { return voicePool.getMaxVoices(); }
+
+    void setVoiceStealing(VoiceStealing v) { voiceStealing = v; }
+    VoiceStealing getVoiceStealing() const { return voiceStealing.load(); }
+    uint32 getStolenNotesCount() const { return stolenNotesCount.load(); }
+    uint32 getDroppedNotesCount() const { return droppedNotesCount.load(); }
+
     Result setLyrics(const String& str);
 
-    void rewind();
+    /**
+     * Apply an edit of the lyrics text.
+     * This must be called outside of the audio thread. Only the phrases
+     * touched by the edit get compiled again, and the playback position
+     * is kept when the new phrase table is swapped in.
+     */
+    Result updateLyrics(const String& str, const Lyrics::Edit& edit);
+
+    /**
+     * Replace the phoneme inventory.
+     * This must be called outside of the audio thread. The current
+     * lyrics get split and compiled again with the new inventory, and the
+     * result is swapped in at the beginning of the next processing block.
+     */
+    Result setPhonemeInventory(const PhonemeInventory::Ptr& ptr);
+
+    /** Returns the inventory used by the audio thread. */
+    const PhonemeInventory& getPhonemeInventory() const { return phraseTable->getInventory(); }
+
+    /**
+     * Move to the given phrase of the lyrics.
+     * This can be called from any thread, the phrase is selected
+     * at the beginning of the next processing block.
+     */
+    Result seekPhrase(size_t index);
+    Result rewind() { return seekPhrase(0); }
+
+    /**
+     * Silence all the voices at once and forget the held keys.
+     * This can be called from any thread, the voices are stopped
+     * at the beginning of the next processing block.
+     * MIDI All Sound Off (CC 120) does the same on the sample it is scheduled.
+     */
+    Result allNotesOff();
+
+    /** Host timeline position placeholder, when the host does not provide one. */
+    constexpr static double UNKNOWN_POSITION = -1.0;
+
+    /**
+     * Set the host timeline position of the next process() block.
+     * While the position is known, the notes get recorded into the cue index.
+     */
+    void setTransportPosition(double position, double quarterNotesPerSample);
+    void clearTransportPosition() { transportPosition = UNKNOWN_POSITION; }
+
+    /**
+     * Move to the phrase to be sung at the given host timeline position.
+     * Returns false if the position could not be resolved via the cue index.
+     * This must be called from the audio thread.
+     */
+    bool seek(double position);
 
     void setLegato(bool l) { legato = l; }
     bool isLegato() const { return legato.load(); }
@@ -89,22 +285,104 @@ public:
      */
     void performHousekeeping();
 
+    /**
+     * Objects released by the audio thread are retired here
+     * and destroyed by performHousekeeping().
+     */
+    constexpr static size_t reclaimerCapacity = 256;
+    using Reclaimer = core::Reclaimer<reclaimerCapacity>;
+
+    Reclaimer& getReclaimer() { return reclaimer; }
+
 private:
 
+    /*
+     * Reconfiguration commands, sent from any thread and applied
+     * by the audio thread at the beginning of each processing block.
+     * No default member initializers, they would make the variant below
+     * non-default-constructible until the engine class is complete.
+     */
+    struct SeekPhrase { size_t index; };
+    struct SetPhraseTable { PhraseTable::Ptr table; };
+    struct SetCueIndex { CueIndex::Ptr index; uint32 numCues; };
+    struct ResizeVoicePool { VoicePool::Bank::Ptr bank; };
+    struct AllNotesOff {};
+
+    using Command = std::variant<SeekPhrase, SetPhraseTable, SetCueIndex, ResizeVoicePool, AllNotesOff>;
+
+    /**
+     * Send a command to the audio thread. Commands carrying an object
+     * reserve room in the reclaimer, as the audio thread retires the object
+     * it replaces.
+     */
+    Result sendCommand(Command&& command, bool carriesObject = false);
+
+    void processCommands();
+    void handleCommand(SeekPhrase& command);
+    void handleCommand(SetPhraseTable& command);
+    void handleCommand(SetCueIndex& command);
+    void handleCommand(ResizeVoicePool& command);
+    void handleCommand(AllNotesOff& command);
+
     Result setLyrics(const Lyrics::Ptr& ptr);
+    Result sendPhraseTable(const Lyrics::Ptr& lyricsPtr, const PhonemeInventory::Ptr& inventoryPtr);
+    Result sendPhraseTable(const std::shared_ptr<PhraseTable>& table);
 
     void updateParameters(size_t numFrames);
-    void noteOn(const MidiMessage& msg);
+    void processLyrics();
+    void releaseRetiredPhraseTables();
+    void handleMidiMessage(const MidiMessage& msg, size_t delay, double position = UNKNOWN_POSITION);
+    void processScheduledMessages(uint64 endTime);
+    uint64 getScheduledTime(int samplePosition) const;
+    void processParameterChanges(uint64 endTime);
+    void applyParameterChange(Control control, float value, size_t rampLength = 0);
+    void applyGain(float* out, size_t numSamples);
+    void noteOn(const MidiMessage& msg, size_t delay, double position);
+    void recordCue(const CueIndex::Cue& cue);
+    void processCues();
+    Result sendCueIndex();
     void noteOff(const MidiMessage& msg);
     void controlChange(const MidiMessage& msg);
     void releaseSustainedVoices();
-
-    void processSubFrame();
+    void releaseAllVoices();
+    void stopAllVoices();
+    Voice* findVoiceToSteal(int key);
+    Voice* findOldestVoice() const;
+    void sortActiveVoices();
+
+    bool canIdle() const;
+    void processIdle(float* outL, float* outR, size_t numFrames);
+    void resumeFromIdle();
+
+    size_t getNumSubFramesRequired(size_t numFrames) const;
+    void render(float* out, size_t numSubFrames);
+    void renderVoices(float* out, size_t firstSubFrame, size_t numSubFrames);
+    void renderVoice(Voice& voice, float* out, size_t firstSubFrame, size_t numSubFrames);
+    void recycleVoices();
+    size_t resample(float* out, size_t numFrames);
 
     float externalSampleRate{ 44100.0f };
+    RenderMode renderMode{ RenderMode::Direct };
+    std::atomic<RenderStrategy> renderStrategy{ RenderStrategy::VoiceMajor };
+    size_t midiSchedulingDelay{ MIDI_SCHEDULING_DELAY };
+
+    /* Must be constructed before the voice pool, which hands its banks over here */
+    Reclaimer reclaimer{};
 
     VoicePool voicePool;
-    core::List<Voice> activeVoices{};
+
+    /*
+     * Dense set of active voices, removed by swapping with the last one.
+     * Before rendering the voices get ordered by articulation state,
+     * and by memory location within each state. This is only done
+     * when voices have been added, removed, released or retriggered.
+     */
+    std::vector<Voice*> activeVoices{};
+    bool activeVoicesChanged{};
+    VoiceKeyIndex keyIndex{};
+
+    /* Voice retriggered by the legato notes, the oldest active voice when it started */
+    Voice* legatoVoice{};
 
     ParameterPool parameters{ TOTAL_PARAMETERS };
 
@@ -115,25 +393,113 @@ private:
     std::atomic<float> envelopeSustain{ 0.75f };
     std::atomic<float> envelopeRelease{ 0.3f };
 
-    AudioBuffer<float> subFrameBuffer{ NUM_CHANNELS, SUB_FRAME_LENGTH };
-    AudioBuffer<float> mixBuffer{ NUM_CHANNELS, SUB_FRAME_LENGTH };
-    size_t remainedSamples{};
+    /*
+     * Mix rendered at the internal sample rate, waiting to be resampled.
+     * In direct mode only the trailing partial sub-frame of a block goes through it.
+     */
+    AudioBuffer<float> renderBuffer{ NUM_CHANNELS, SUB_FRAME_LENGTH };
+    size_t maxSubFrames{ 1 };
+    size_t renderPosition{};
+    size_t renderedSamples{};
+    uint64 renderTime{};    // Total number of internal samples rendered
+
+    /* Silent samples rendered in a row, and the internal time skipped over while idle */
+    size_t silentSamples{};
+    double idleTime{};
+    bool idle{};
+
+    /* Mix buffers of the worker threads, the calling thread renders directly into the output */
+    AudioBuffer<float> workerBuffer{};
+    std::vector<float*> workerOutputs{};
+    std::atomic<size_t> numWorkerThreads{};
+    WorkerPool workerPool{};
+
+    /* Control-rate values of the vibrato parameter for each rendered sub-frame */
+    std::vector<float> subFrameVibrato{};
+
+    /* Smoothed expression gain of the rendered samples */
+    std::vector<float> gainBuffer{};
+
+    /* Odd sample left over by the half-band upsampler */
+    float halfBandSample{};
+    bool halfBandPending{};
+
+    /* MIDI messages waiting to be applied, sorted by the internal sample time */
+    struct ScheduledMessage
+    {
+        uint64 time{};
+        MidiMessage message{};
+        double position{ UNKNOWN_POSITION };   // Host timeline position [quarter notes]
+    };
+
+    constexpr static size_t scheduledMessagesCapacity = 1024;
+    std::vector<ScheduledMessage> scheduledMessages{};
+    size_t nextScheduledMessage{};
+
+    /* Control changes waiting to be applied, in time order */
+    struct ParameterChange
+    {
+        uint64 time{};
+        Control control{};
+        float value{};
+        uint32 rampLength{};    // Internal samples, zero for a smoothed change
+    };
+
+    constexpr static size_t parameterQueueSize = 256;
+    core::Queue<ParameterChange, parameterQueueSize> parameterChanges{};
+    ParameterChange nextParameterChange{};
+    bool parameterChangePending{};
+    uint64 lastParameterChangeTime{};
+
+    std::atomic<VoiceStealing> voiceStealing{ VoiceStealing::ReleasingFirst };
+    std::atomic<uint32> stolenNotesCount{};
+    std::atomic<uint32> droppedNotesCount{};
+    uint32 noteSerial{};
 
-    std::bitset<128> keysState{};
+    std::bitset<VoiceKeyIndex::NUM_KEYS> keysState{};
+    std::bitset<VoiceKeyIndex::NUM_KEYS> sustainedKeys{};
     bool sustained{};
 
-    constexpr static size_t lyricsQueueSize = 64;
-    core::Queue<Lyrics::Ptr, lyricsQueueSize> setLyricsQueue{};
-    core::Queue<Lyrics::Ptr, lyricsQueueSize> disposeLyricsQueue{};
+    /* Commands received per block are bounded by the queue size */
+    constexpr static size_t commandQueueSize = 64;
+    core::MPSCQueue<Command, commandQueueSize> commands{};
+
+    PhraseTable::Ptr phraseTable{};
+    PhraseTable::Ptr pendingPhraseTable{};
 
-    constexpr static size_t lyricsMaxPhrases = 4096;
-    std::array<Voice::Phrase, lyricsMaxPhrases> lyrics{};
+    /* Replaced tables are kept until the voices stop playing their phrases */
+    constexpr static size_t maxRetiredPhraseTables = 8;
+    std::vector<PhraseTable::Ptr> retiredPhraseTables{};
     std::atomic<size_t> lyricsNumPhrases{};
     std::atomic<size_t> phraseIndex{};
 
+    /* Message thread copies of the current lyrics, phoneme inventory and phrase table */
     Lyrics::Ptr cachedLyrics{};
+    PhonemeInventory::Ptr cachedPhonemeInventory{};
+    PhraseTable::Ptr cachedPhraseTable{};
+
+    /* Host timeline position of the current block [quarter notes] */
+    double transportPosition{ UNKNOWN_POSITION };
+    double transportRate{};
+
+    /*
+     * Phrases sung along the host timeline, recorded here and indexed on the message thread.
+     * The index is only sent back once enough new cues have piled up, meanwhile
+     * the audio thread keeps the cues recorded since the index it has got.
+     */
+    constexpr static size_t cueQueueSize = 256;
+    constexpr static size_t cueIndexUpdateThreshold = cueQueueSize / 2;
+    core::Queue<CueIndex::Cue, cueQueueSize> recordedCuesQueue{};
+    CueIndex::Ptr cueIndex{};
+    std::array<CueIndex::Cue, cueQueueSize> recentCues{};
+    size_t numRecentCues{};
+    uint32 recordedCuesCount{};     // Cues sent to the message thread so far
+    CueIndex cachedCueIndex{};
+    uint32 receivedCuesCount{};     // Cues received on the message thread so far
+    uint32 indexedCuesCount{};      // Cues received when the index has been sent last
 
     Interpolator interpolator{ 1.0f, NUM_CHANNELS };
+    HalfBandUpsampler upsampler{};
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Engine)
 };
@@ -34,6 +34,12 @@ void Envelope::retrigger()
         currentState = State::Attack;
 }
 
+void Envelope::reset()
+{
+    currentState = State::Off;
+    currentLevel = 0.0f;
+}
+
 void Envelope::release()
 {
     currentState = State::Release;
@@ -86,6 +92,58 @@ float Envelope::getNext()
     return currentLevel;
 }
 
+void Envelope::render(float* gain, size_t numFrames, float scale)
+{
+    jassert(gain != nullptr);
+
+    size_t i{};
+
+    while (i < numFrames) {
+        switch (currentState) {
+        case State::Attack:
+            if (renderSegment(gain, i, numFrames, scale, attackBase, attackCoef, 1.0f, true))
+                currentState = State::Decay;
+            break;
+        case State::Decay:
+            if (renderSegment(gain, i, numFrames, scale, decayBase, decayCoef, sustainLevel, false))
+                currentState = State::Sustain;
+            break;
+        case State::Release:
+            if (renderSegment(gain, i, numFrames, scale, releaseBase, releaseCoef, 0.0f, false))
+                currentState = State::Off;
+            break;
+        case State::Off:
+        case State::Sustain:
+        default:
+            // The level is held
+            FloatVectorOperations::fill(gain + i, currentLevel * scale, (int)(numFrames - i));
+            i = numFrames;
+            break;
+        }
+    }
+}
+
+bool Envelope::renderSegment(float* gain, size_t& pos, size_t numFrames, float scale, float base, float coef, float limit, bool rising)
+{
+    float level{ currentLevel };
+
+    for (; pos < numFrames; ++pos) {
+        level = base + level * coef;
+
+        if (rising ? level >= limit : level <= limit) {
+            currentLevel = limit;
+            gain[pos++] = limit * scale;
+            return true;
+        }
+
+        gain[pos] = level * scale;
+    }
+
+    currentLevel = level;
+
+    return false;
+}
+
 float Envelope::calculate(float rate, float targetRatio)
 {
     return rate <= 0 ? 0.0f : std::exp(-std::log((1.0f + targetRatio) / targetRatio) / rate);
@@ -41,17 +41,28 @@ public:
 
     void trigger(const Spec& spec);
     void retrigger();
+    void reset();
     void release();
     void release(float t);
 
     float getNext();
 
+    /**
+     * Render the envelope levels multiplied by the scale.
+     * The levels are the same as the ones returned by getNext(),
+     * but the state is only checked when a segment ends.
+     */
+    void render(float* gain, size_t numFrames, float scale = 1.0f);
+
     float getLevel() const noexcept { return currentLevel; }
 
 private:
 
     static float calculate(float rate, float targetRatio);
 
+    /** Run the segment recurrence from the position until the level reaches the limit, or the end of the buffer. */
+    bool renderSegment(float* gain, size_t& pos, size_t numFrames, float scale, float base, float coef, float limit, bool rising);
+
     State currentState{ State::Off };
     float currentLevel{ 0.0f };
 
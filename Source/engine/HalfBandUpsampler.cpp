@@ -0,0 +1,50 @@
+#include "engine/HalfBandUpsampler.h"
+
+namespace engine {
+
+/**
+ * Odd polyphase branch of a Blackman-windowed half-band filter,
+ * normalized for unity DC gain. The coefficients are applied symmetrically
+ * to the samples at +/- (k + 1/2) around the interpolated position.
+ */
+constexpr static std::array<float, 4> halfBandCoefs {
+    0.597082282f, -0.117649547f, 0.021896820f, -0.001329554f
+};
+
+//==============================================================================
+
+HalfBandUpsampler::HalfBandUpsampler()
+{
+    reset();
+}
+
+void HalfBandUpsampler::reset()
+{
+    history.fill(0.0f);
+    historyIndex = 0;
+}
+
+void HalfBandUpsampler::process(const float* in, float* out, size_t numFrames) noexcept
+{
+    jassert(in != nullptr && out != nullptr);
+
+    for (size_t i = 0; i < numFrames; ++i) {
+        // History is mirrored so that the last NUM_TAPS samples are always contiguous
+        history[historyIndex] = history[historyIndex + NUM_TAPS] = in[i];
+
+        // h[0] is the oldest sample, h[NUM_TAPS - 1] is the newest one
+        const float* const h{ &history[historyIndex + 1] };
+
+        historyIndex = (historyIndex + 1) % NUM_TAPS;
+
+        // Even sample is delayed to be aligned with the filter center
+        out[2 * i] = h[3];
+
+        out[2 * i + 1] = halfBandCoefs[0] * (h[3] + h[4])
+                       + halfBandCoefs[1] * (h[2] + h[5])
+                       + halfBandCoefs[2] * (h[1] + h[6])
+                       + halfBandCoefs[3] * (h[0] + h[7]);
+    }
+}
+
+} // namespace engine
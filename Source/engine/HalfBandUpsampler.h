@@ -0,0 +1,36 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <array>
+
+namespace engine {
+
+/**
+ * @brief 2x upsampler based on a symmetric half-band FIR filter.
+ *
+ * Even output samples are the (delayed) input samples, odd output
+ * samples are computed from the 8-tap polyphase branch of the half-band filter.
+ * This is used when the host sample rate is exactly twice the internal one.
+ */
+class HalfBandUpsampler final
+{
+public:
+    HalfBandUpsampler();
+
+    void reset();
+
+    /**
+     * Upsample numFrames input samples into 2 * numFrames output samples.
+     */
+    void process(const float* in, float* out, size_t numFrames) noexcept;
+
+private:
+    constexpr static size_t NUM_TAPS = 8;
+
+    using History = std::array<float, NUM_TAPS * 2>;
+
+    History history{};
+    size_t historyIndex{};
+};
+
+} // namespace engine
@@ -23,10 +23,28 @@ inline T lagr (const T* const x, T frac) noexcept
     return ((c3 * frac + c2) * frac + c1) * frac + x[1];
 }
 
+/**
+ * Compute 4-point Lagrange weights for the x[-1], x[0], x[1], x[2] samples.
+ * This is equivalent to lagr() but allows sharing the weights between channels.
+ */
+template <typename T>
+inline void lagrWeights (T frac, T* const w) noexcept
+{
+    const T fp1 = frac + 1.0f;
+    const T fm1 = frac - 1.0f;
+    const T fm2 = frac - 2.0f;
+
+    w[0] = -(1.0f / 6.0f) * frac * fm1 * fm2;
+    w[1] = 0.5f * fp1 * fm1 * fm2;
+    w[2] = -0.5f * fp1 * frac * fm2;
+    w[3] = (1.0f / 6.0f) * fp1 * frac * fm1;
+}
+
 //==============================================================================
 
 Interpolator::Interpolator(float ratio, size_t nChannels)
-    : acc(nChannels)
+    : acc(HISTORY_LENGTH * nChannels)
+    , numChannels{nChannels}
     , accIndex{0}
     , accFrac{0.0f}
     , ratio{ratio}
@@ -37,20 +55,85 @@ Interpolator::Interpolator(float ratio, size_t nChannels)
 void Interpolator::setNumberOfChannels(size_t n)
 {
     jassert(n > 0);
-    acc.resize(n);
+    numChannels = n;
+    acc.resize(HISTORY_LENGTH * numChannels);
     reset();
 }
 
 void Interpolator::reset()
 {
-    for (auto& buf : acc) {
-        ::memset(buf.data(), 0, sizeof(float) * 8);
-    }
+    std::fill(acc.begin(), acc.end(), 0.0f);
 
     accIndex = 0;
     accFrac = 0.0f;
 }
 
+Interpolator::Count Interpolator::process(const float* const* in, size_t nIn, float* const* out, size_t nOut) noexcept
+{
+    jassert(in != nullptr || nIn == 0);
+    jassert(out != nullptr || nOut == 0);
+
+    Count count{};
+    float w[4]{};
+
+    auto writeFrame = [&]() {
+        float* const a{ frame(accIndex) };
+        float* const b{ frame(accIndex + 4) };
+
+        for (size_t ch = 0; ch < numChannels; ++ch)
+            a[ch] = b[ch] = in[ch][count.consumed];
+
+        accIndex = (accIndex + 1) % 4;
+        accFrac -= 1.0f;
+        ++count.consumed;
+    };
+
+    while (count.produced < nOut) {
+        if (accFrac < 1.0f) {
+            lagrWeights(accFrac, w);
+
+            const float* const x_1{ frame(accIndex) };
+            const float* const x0{ x_1 + numChannels };
+            const float* const x1{ x0 + numChannels };
+            const float* const x2{ x1 + numChannels };
+
+            for (size_t ch = 0; ch < numChannels; ++ch)
+                out[ch][count.produced] = w[0] * x_1[ch] + w[1] * x0[ch] + w[2] * x1[ch] + w[3] * x2[ch];
+
+            accFrac += ratio;
+            ++count.produced;
+        } else if (count.consumed < nIn) {
+            writeFrame();
+        } else {
+            break;
+        }
+    }
+
+    // Consume as much input as possible even when the output is full
+    while (count.consumed < nIn && accFrac >= 1.0f)
+        writeFrame();
+
+    return count;
+}
+
+size_t Interpolator::getNumInputsRequired(size_t nOut) const noexcept
+{
+    // Replay the fractional position exactly as process() would update it
+    float frac{ accFrac };
+    size_t nIn{};
+
+    for (size_t i = 0; i < nOut; ++i) {
+        while (frac >= 1.0f) {
+            frac -= 1.0f;
+            ++nIn;
+        }
+
+        frac += ratio;
+    }
+
+    return nIn;
+}
+
 bool Interpolator::canRead() const noexcept
 {
     return accFrac < 1.0f;
@@ -63,8 +146,8 @@ bool Interpolator::readAllChannels(float* const x) noexcept
     if (accFrac >= 1.0f)
         return false;
 
-    for (size_t i = 0; i < acc.size(); ++i) {
-        x[i] = lagr(&acc[i].data()[accIndex], accFrac);
+    for (size_t i = 0; i < numChannels; ++i) {
+        x[i] = readUnchecked(i);
     }
 
     accFrac += ratio;
@@ -76,14 +159,16 @@ float Interpolator::readUnchecked(size_t channel) const noexcept
 {
     jassert(accFrac < 1.0f);
 
-    return lagr(&acc[channel].data()[accIndex], accFrac);
+    const float* const x{ frame(accIndex) + channel };
+
+    return lagr(x[0], x[numChannels], x[2 * numChannels], x[3 * numChannels], accFrac);
 }
 
 float Interpolator::readLinearUnchecked(size_t channel) const noexcept
 {
     jassert(accFrac < 1.0f);
 
-    return lerp(acc[channel].data()[accIndex], acc[channel].data()[accIndex + 1], accFrac);
+    return lerp(frame(accIndex)[channel], frame(accIndex + 1)[channel], accFrac);
 }
 
 void Interpolator::readIncrement()
@@ -91,21 +176,6 @@ void Interpolator::readIncrement()
     accFrac += ratio;
 }
 
-bool Interpolator::read(float& l, float& r) noexcept
-{
-    jassert(acc.size() > 1);
-
-    if (accFrac >= 1.0f)
-        return false;
-
-    l = lagr(&acc[0].data()[accIndex], accFrac);
-    r = lagr(&acc[1].data()[accIndex], accFrac);
-
-    accFrac += ratio;
-
-    return true;
-}
-
 bool Interpolator::canWrite() const noexcept
 {
     return accFrac >= 1.0f;
@@ -118,8 +188,8 @@ bool Interpolator::writeAllChannels(const float* const x) noexcept
     if (accFrac < 1.0f)
         return false;
 
-    for (size_t i = 0; i < acc.size(); ++i) {
-        acc[i][accIndex] = acc[i][accIndex + 4] = x[i];
+    for (size_t i = 0; i < numChannels; ++i) {
+        frame(accIndex)[i] = frame(accIndex + 4)[i] = x[i];
     }
 
     accIndex = (accIndex + 1) % 4;
@@ -130,9 +200,9 @@ bool Interpolator::writeAllChannels(const float* const x) noexcept
 
 void Interpolator::writeUnchecked(float x, size_t channel)
 {
-    jassert(acc.size() > 1);
+    jassert(channel < numChannels);
 
-    acc[channel][accIndex] = acc[channel][accIndex + 4] = x;
+    frame(accIndex)[channel] = frame(accIndex + 4)[channel] = x;
 }
 
 void Interpolator::writeIncrement()
@@ -141,20 +211,4 @@ void Interpolator::writeIncrement()
     accFrac -= 1.0f;
 }
 
-bool Interpolator::write(float l, float r) noexcept
-{
-    jassert(acc.size() > 1);
-
-    if (accFrac < 1.0f)
-        return false;
-
-    acc[0][accIndex] = acc[0][accIndex + 4] = l;
-    acc[1][accIndex] = acc[1][accIndex + 4] = r;
-
-    accIndex = (accIndex + 1) % 4;
-    accFrac -= 1.0f;
-
-    return true;
-}
-
 } // namespace engine
@@ -8,39 +8,68 @@ namespace engine {
 /**
  * @brief Lagrange interpolator.
  *
+ * Samples history is stored interleaved (frame by frame), so that
+ * all the channels can be interpolated at once using the same
+ * set of Lagrange weights.
+ *
  * @note This class does not apply an interpolation filter when downsampling.
  */
 class Interpolator
 {
 public:
+
+    /** Result of a block conversion. */
+    struct Count
+    {
+        size_t consumed{};  // Number of input samples written
+        size_t produced{};  // Number of output samples read
+    };
+
     Interpolator(float ratio = 1.0f, size_t nChannels = 1);
 
     void setRatio(float r) noexcept { ratio = r; }
     float getRatio() const noexcept { return ratio; }
 
     void setNumberOfChannels(size_t n);
-    size_t getNumberOfChannels() const noexcept { return acc.size(); }
+    size_t getNumberOfChannels() const noexcept { return numChannels; }
 
     void reset();
 
+    /**
+     * Convert a block of samples.
+     *
+     * This will consume up to nIn input samples and produce up to nOut
+     * output samples for every channel, stopping when either the input
+     * is exhausted or the output is full.
+     */
+    Count process(const float* const* in, size_t nIn, float* const* out, size_t nOut) noexcept;
+
+    /**
+     * Returns the number of input samples that have to be written
+     * in order to read the next nOut output samples.
+     */
+    size_t getNumInputsRequired(size_t nOut) const noexcept;
+
     bool canRead() const noexcept;
     bool readAllChannels(float* const x) noexcept;
     float readUnchecked(size_t channel) const noexcept;
     float readLinearUnchecked(size_t channel) const noexcept;
     void readIncrement();
-    bool read(float& l, float& r) noexcept;
-
 
     bool canWrite() const noexcept;
     bool writeAllChannels(const float* const x) noexcept;
     void writeUnchecked(float x, size_t channel);
     void writeIncrement();
-    bool write(float l, float r) noexcept;
 
 private:
-    using SamplesBuffer = std::array<float, 8>;
+    constexpr static size_t HISTORY_LENGTH = 8;
+
+    float* frame(size_t index) noexcept { return &acc[index * numChannels]; }
+    const float* frame(size_t index) const noexcept { return &acc[index * numChannels]; }
 
-    std::vector<SamplesBuffer> acc;
+    /** Interleaved samples history, HISTORY_LENGTH frames of numChannels samples. */
+    std::vector<float> acc;
+    size_t numChannels{};
 
     int accIndex{};
     float accFrac{};
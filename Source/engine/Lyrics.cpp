@@ -2,105 +2,267 @@
 
 namespace engine {
 
-template <typename T>
-static bool isWhiteChar(const T t)
+static bool isAlphaOrDash(char c)
 {
-    return t == ' ' || t== ',' || t == '\t' || t == '\r' || t == '\n';
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c == '-');
 }
 
-template <typename T>
-static bool isAlphaOrDash(const T t)
+static bool isUTF8Continuation(char c)
 {
-    return (t >= 'a' && t <= 'z') || (t >= 'A' && t <= 'Z') || (t == '-');
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+static std::string_view rebase(std::string_view view, const std::string& from, const std::string& to, std::ptrdiff_t shift)
+{
+    if (view.data() == nullptr)
+        return view;
+
+    const auto offset{ view.data() - from.data() + shift };
+    jassert(offset >= 0 && (size_t)offset + view.size() <= to.size());
+
+    return { to.data() + offset, view.size() };
+}
+
+//==============================================================================
+
+void Lyrics::Edit::insert(int index, int length)
+{
+    const Range<int> inserted{ index, index + length };
+
+    if (pending) {
+        // Positions past the insertion point get shifted
+        const int end{ range.getEnd() >= index ? range.getEnd() + length : range.getEnd() };
+        range = Range<int>(jmin(range.getStart(), index), jmax(end, inserted.getEnd()));
+    } else {
+        range = inserted;
+    }
+
+    lengthDelta += length;
+    pending = true;
+}
+
+void Lyrics::Edit::remove(int start, int end)
+{
+    const int length{ end - start };
+
+    if (pending) {
+        // Positions past the removed range get shifted, the ones within collapse
+        int rangeEnd{ range.getEnd() };
+
+        if (rangeEnd >= end)
+            rangeEnd -= length;
+        else if (rangeEnd > start)
+            rangeEnd = start;
+
+        range = Range<int>(jmin(range.getStart(), start), jmax(rangeEnd, start));
+    } else {
+        range = Range<int>(start, start);
+    }
+
+    lengthDelta -= length;
+    pending = true;
 }
 
 //==============================================================================
 
-Lyrics::Lyrics()
+Lyrics::Lyrics(const PhonemeInventory::Ptr& inv)
+    : inventory{ inv }
 {
+    jassert(inventory != nullptr);
 }
 
 void Lyrics::clear()
 {
+    text.clear();
     phrases.clear();
 }
 
-Result Lyrics::parse0(const String& str)
+Result Lyrics::parse(const String& str)
+{
+    const char* utf8{ str.toRawUTF8() };
+    return parse(std::string_view(utf8, str.getNumBytesAsUTF8()));
+}
+
+Result Lyrics::parse(std::string_view str)
 {
     clear();
-    const StringArray tokens{ StringArray::fromTokens(str, " ,\t\r\n", "") };
+    setText(str);
+    scan(0, text.size(), 0);
 
-    if (tokens.isEmpty())
-        return Result::fail("Enpty lyrics");
+    return Result::ok();
+}
 
-    for (const auto& token : tokens) {
-        const String sToken{ token.trim().toLowerCase() };
+Result Lyrics::parse(const Lyrics& previous, const String& str, const Edit& edit, Patch& patch)
+{
+    const char* utf8{ str.toRawUTF8() };
+    return parse(previous, std::string_view(utf8, str.getNumBytesAsUTF8()), edit, patch);
+}
+
+Result Lyrics::parse(const Lyrics& previous, std::string_view str, const Edit& edit, Patch& patch)
+{
+    jassert(&previous != this);
+
+    if (!edit.pending || previous.inventory != inventory) {
+        patch = {};
+        return parse(str);
+    }
+
+    clear();
+    setText(str);
 
-        if (!sToken.isEmpty()) {
-            const StringArray sPhrase{ StringArray::fromTokens(sToken, "-", "") };
+    const auto& prev{ previous.phrases };
+    const int editStart{ edit.range.getStart() };
+    const int editEnd{ edit.range.getEnd() };
+    const int previousEditEnd{ editEnd - edit.lengthDelta };
 
-            if (sPhrase.isEmpty())
-                return Result::fail("Empty phrase detected");
+    if (editStart < 0 || previousEditEnd < editStart)
+        return Result::fail("Invalid lyrics edit");
 
-            if (sPhrase.size() > 2)
-                return Result::fail("Too many parts in a phrase");
+    // Phrases touching the edited range get replaced
+    size_t first{};
 
-            if (sPhrase.size() > 0) {
-                Phrase phrase{};
-                phrase.attack = sPhrase[0].trim();
+    while (first < prev.size() && prev[first].position.getEnd() < editStart)
+        ++first;
 
-                if (phrase.attack.isEmpty())
-                    return Result::fail("Attack part of the phrase is missing");
+    size_t last{ first };
 
-                if (sPhrase.size() > 1) {
-                    phrase.release = sPhrase[1].trim();
-                }
+    while (last < prev.size() && prev[last].position.getStart() <= previousEditEnd)
+        ++last;
 
-                phrases.push_back(std::move(phrase));
-            }
+    int scanStart{ editStart };
+    int scanEnd{ editEnd };
+
+    if (last > first) {
+        scanStart = jmin(scanStart, prev[first].position.getStart());
+        scanEnd = jmax(scanEnd, prev[last - 1].position.getEnd() + edit.lengthDelta);
+    }
+
+    // The text before the first replaced phrase is unchanged
+    phrases.reserve(prev.size() + 1);
+
+    for (size_t i = 0; i < first; ++i) {
+        auto phrase{ prev[i] };
+        phrase.attack = rebase(phrase.attack, previous.text, text, 0);
+        phrase.release = rebase(phrase.release, previous.text, text, 0);
+        phrases.push_back(phrase);
+    }
+
+    size_t pos{};
+    int charPos{};
+
+    if (first > 0) {
+        // Start walking the text from the last phrase kept
+        const auto& anchor{ prev[first - 1] };
+        pos = (size_t)(anchor.attack.data() - previous.text.data());
+        charPos = anchor.position.getStart();
+    }
+
+    auto advanceTo = [&](int targetCharPos) {
+        while (pos < text.size() && (charPos < targetCharPos || isUTF8Continuation(text[pos]))) {
+            if (!isUTF8Continuation(text[pos]))
+                ++charPos;
+
+            ++pos;
         }
+    };
+
+    advanceTo(scanStart);
+    const size_t scanStartPos{ pos };
+    const int scanStartCharPos{ charPos };
+
+    advanceTo(scanEnd);
+    scan(scanStartPos, pos, scanStartCharPos);
+
+    patch.firstPhrase = first;
+    patch.numRemoved = last - first;
+    patch.numInserted = phrases.size() - first;
+
+    // The text after the last replaced phrase is shifted
+    const auto shift{ (std::ptrdiff_t)text.size() - (std::ptrdiff_t)previous.text.size() };
+
+    for (size_t i = last; i < prev.size(); ++i) {
+        auto phrase{ prev[i] };
+        phrase.attack = rebase(phrase.attack, previous.text, text, shift);
+        phrase.release = rebase(phrase.release, previous.text, text, shift);
+        phrase.position += edit.lengthDelta;
+        phrases.push_back(phrase);
     }
 
     return Result::ok();
 }
 
-Result Lyrics::parse(const String& str)
+void Lyrics::setText(std::string_view str)
 {
-    clear();
+    // Single copy of the whole text, the phrases refer to it
+    text.resize(str.size());
+    std::transform(str.begin(), str.end(), text.begin(), PhonemeInventory::toLowerASCII);
+}
+
+size_t Lyrics::readCharacter(std::string_view str, bool& isPhraseChar) const
+{
+    if (isAlphaOrDash(str[0])) {
+        isPhraseChar = true;
+        return 1;
+    }
+
+    // Other characters only belong to phrases when the inventory has symbols for them
+    juce_wchar c{};
+    const auto length{ PhonemeInventory::decodeCharacter(str, c) };
+    isPhraseChar = c >= 0x80 && inventory->isSymbolCharacter(c);
+
+    return length;
+}
+
+void Lyrics::scan(size_t pos, size_t end, int charPos)
+{
+    // Positions are counted in characters, as seen by the text editor
+    const std::string_view view{ text };
+    jassert(end <= view.size());
+
+    bool isPhraseChar{};
+    size_t length{};
 
-    const auto length{ str.length() };
+    while (pos < end) {
+        length = readCharacter(view.substr(pos, end - pos), isPhraseChar);
+
+        if (!isPhraseChar) {
+            pos += length;
+            ++charPos;
+            continue;
+        }
 
-    int pos{ 0 };
+        const size_t startPos{ pos };
+        const int startCharPos{ charPos };
+        size_t dashPos{ std::string_view::npos };
 
-    auto isOver = [&]() { return pos >= length; };
-    auto skipSpaces = [&]() { for (; pos < length && isWhiteChar(str[pos]); ++pos); };
-    auto skipAlphaOrDash = [&]() { for (; pos < length && isAlphaOrDash(str[pos]); ++pos); };
+        while (isPhraseChar) {
+            if (view[pos] == '-' && dashPos == std::string_view::npos)
+                dashPos = pos;
 
-    while (pos < length) {
-        skipSpaces();
-        if (isOver()) break;
+            pos += length;
+            ++charPos;
 
-        int startPos{ pos };
-        skipAlphaOrDash();
-        int stopPos{ pos };
-        String s{ str.substring(startPos, stopPos) };
+            if (pos >= end)
+                break;
 
-        if (!s.isEmpty()) {
-            Phrase phrase{};
-            phrase.position = Range<int>(startPos, stopPos);
+            length = readCharacter(view.substr(pos, end - pos), isPhraseChar);
+        }
 
-            const StringArray tokens{ StringArray::fromTokens(s, "-", "") };
+        Phrase phrase{};
+        phrase.position = Range<int>(startCharPos, charPos);
 
-            if (tokens.size() > 0)
-                phrase.attack = tokens[0].trim().toLowerCase();
-            if (tokens.size() > 1)
-                phrase.release = tokens[1].trim().toLowerCase();
+        if (dashPos == std::string_view::npos) {
+            phrase.attack = view.substr(startPos, pos - startPos);
+        } else {
+            phrase.attack = view.substr(startPos, dashPos - startPos);
 
-            phrases.push_back(std::move(phrase));
+            // Anything past the second dash is ignored
+            const auto release{ view.substr(dashPos + 1, pos - dashPos - 1) };
+            phrase.release = release.substr(0, release.find('-'));
         }
-    }
 
-    return Result::ok();
+        phrases.push_back(phrase);
+    }
 }
 
 const Lyrics::Phrase& Lyrics::operator[](size_t index) const
@@ -108,7 +270,7 @@ const Lyrics::Phrase& Lyrics::operator[](size_t index) const
     const static Phrase dummy{};
 
     if (index < phrases.size())
-        return phrases.at(index);
+        return phrases[index];
 
     return dummy;
 }
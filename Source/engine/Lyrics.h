@@ -1,10 +1,22 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "engine/PhonemeInventory.h"
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace engine {
 
+/**
+ * Lyrics split into phrases.
+ *
+ * The text is kept as a single lower-case UTF-8 copy, phrases
+ * refer to it without copying. A phrase is a word of letters where
+ * an optional dash separates the attack and release parts. Non-ASCII
+ * characters belong to words only when the phoneme inventory uses them
+ * in its symbols, the other ones are separators.
+ */
 class Lyrics
 {
 public:
@@ -12,22 +24,70 @@ public:
 
     struct Phrase
     {
-        String attack{};
-        String release{};
-        Range<int> position{};
+        std::string_view attack{};
+        std::string_view release{};
+        Range<int> position{};  // Characters range in the source text
     };
 
-    Lyrics();
+    /**
+     * Text edits accumulated since the lyrics have been parsed.
+     * The range is expressed in the characters of the edited text.
+     */
+    struct Edit
+    {
+        Range<int> range{};
+        int lengthDelta{};
+        bool pending{};
+
+        void insert(int index, int length);
+        void remove(int start, int end);
+    };
+
+    /**
+     * Phrases replaced by an incremental update.
+     * Phrases before the first one are kept, the ones past the
+     * removed range are kept as well but get shifted.
+     */
+    struct Patch
+    {
+        size_t firstPhrase{};
+        size_t numRemoved{};
+        size_t numInserted{};
+    };
+
+    explicit Lyrics(const PhonemeInventory::Ptr& inv);
     virtual ~Lyrics() = default;
     void clear();
-    Result parse0(const String& str);
     Result parse(const String& str);
+    Result parse(std::string_view str);
+
+    /**
+     * Parse the edited text reusing the phrases of the previous lyrics.
+     * Only the phrases touched by the edit get scanned again, unless the
+     * previous lyrics have been split with another phoneme inventory.
+     */
+    Result parse(const Lyrics& previous, std::string_view str, const Edit& edit, Patch& patch);
+    Result parse(const Lyrics& previous, const String& str, const Edit& edit, Patch& patch);
 
     size_t size() const { return phrases.size(); }
     const Phrase& operator[](size_t index) const;
 
+    /** Lower-case copy of the parsed text. */
+    std::string_view getText() const { return text; }
+
+    const PhonemeInventory::Ptr& getInventoryPtr() const { return inventory; }
+
 private:
+
+    void setText(std::string_view str);
+    void scan(size_t pos, size_t end, int charPos);
+    size_t readCharacter(std::string_view str, bool& isPhraseChar) const;
+
+    PhonemeInventory::Ptr inventory;
+    std::string text{};
     std::vector<Phrase> phrases{};
+
+    JUCE_DECLARE_NON_COPYABLE(Lyrics)
 };
 
 } // namespace engine
@@ -1,7 +1,30 @@
 #include "engine/Parameter.h"
+#include <array>
 
 namespace engine {
 
+/*
+ * Smoothing converges exponentially to the target, so that the distance to
+ * the target after n steps is (1 - frac)^n of the initial one. Ramps are
+ * computed over interleaved lanes, each one stepping by (1 - frac)^LANES,
+ * which removes the sample to sample dependency and lets the loops vectorize.
+ */
+constexpr static size_t LANES = 4;
+
+static std::array<float, LANES> initRampLanes(float delta, float decay, float& laneDecay)
+{
+    std::array<float, LANES> lanes{};
+    laneDecay = 1.0f;
+
+    for (size_t j = 0; j < LANES; ++j) {
+        delta *= decay;
+        laneDecay *= decay;
+        lanes[j] = delta;
+    }
+
+    return lanes;
+}
+
 Parameter::Parameter(float value, float min, float max, float smooth)
     : currentValue{ value },
       minValue{ min },
@@ -15,6 +38,7 @@ Parameter::Parameter(float value, float min, float max, float smooth)
 void Parameter::setValue(float v, float s, bool force)
 {
     targetValue = jlimit(minValue, maxValue, v);
+    rampRemaining = 0;
 
     frac = jlimit(0.0f, 1.0f, s);
 
@@ -29,6 +53,7 @@ void Parameter::setValue(float v, float s, bool force)
 void Parameter::setValue(float v, bool force)
 {
     targetValue = jlimit(minValue, maxValue, v);
+    rampRemaining = 0;
 
     if (force) {
         currentValue = targetValue;
@@ -38,6 +63,21 @@ void Parameter::setValue(float v, bool force)
     }
 }
 
+void Parameter::rampTo(float v, size_t numFrames)
+{
+    targetValue = jlimit(minValue, maxValue, v);
+
+    if (numFrames == 0 || targetValue == currentValue) {
+        rampRemaining = 0;
+        updateSmoothing();
+        return;
+    }
+
+    rampStep = (targetValue - currentValue) / (float)numFrames;
+    rampRemaining = numFrames;
+    smoothing = true;
+}
+
 void Parameter::setSmoothing(float s) noexcept
 {
     frac = jlimit(0.0f, 1.0f, s);
@@ -57,6 +97,9 @@ Parameter& Parameter::operator = (float v)
 
 float Parameter::getNextValue()
 {
+    if (advanceRamp(1) == 0)
+        return currentValue;
+
     updateSmoothing();
 
     if (smoothing) {
@@ -73,13 +116,121 @@ float Parameter::getNextValue()
 
 float Parameter::getNextValue(size_t numFrames)
 {
-    float v{ currentValue };
+    numFrames = advanceRamp(numFrames);
+    updateSmoothing();
+
+    if (smoothing && numFrames > 0) {
+        currentValue = targetValue + (currentValue - targetValue) * std::pow(1.0f - frac, (float)numFrames);
+        updateSmoothing();
+    }
+
+    return currentValue;
+}
+
+void Parameter::getNextValues(float* out, size_t numFrames)
+{
+    jassert(out != nullptr);
+
+    if (rampRemaining > 0) {
+        const size_t n{ jmin(numFrames, rampRemaining) };
+        const float start{ currentValue };
+
+        for (size_t i = 0; i < n; ++i)
+            out[i] = start + rampStep * (float)(i + 1);
+
+        advanceRamp(n);
+        out += n;
+        numFrames -= n;
+    }
+
+    updateSmoothing();
 
-    for (size_t i = 0; i < numFrames && smoothing; ++i) {
-        v = getNextValue();
+    if (!smoothing || numFrames == 0) {
+        FloatVectorOperations::fill(out, currentValue, (int)numFrames);
+        return;
     }
 
-    return v;
+    float laneDecay{};
+    auto lanes{ initRampLanes(currentValue - targetValue, 1.0f - frac, laneDecay) };
+
+    size_t i{};
+
+    for (; i + LANES <= numFrames; i += LANES) {
+        for (size_t j = 0; j < LANES; ++j) {
+            out[i + j] = targetValue + lanes[j];
+            lanes[j] *= laneDecay;
+        }
+    }
+
+    for (size_t j = 0; i < numFrames; ++i, ++j)
+        out[i] = targetValue + lanes[j];
+
+    currentValue = out[numFrames - 1];
+    updateSmoothing();
+}
+
+void Parameter::applyGain(float* buffer, size_t numFrames)
+{
+    jassert(buffer != nullptr);
+
+    if (rampRemaining > 0) {
+        const size_t n{ jmin(numFrames, rampRemaining) };
+        const float start{ currentValue };
+
+        for (size_t i = 0; i < n; ++i)
+            buffer[i] *= start + rampStep * (float)(i + 1);
+
+        advanceRamp(n);
+        buffer += n;
+        numFrames -= n;
+    }
+
+    updateSmoothing();
+
+    if (!smoothing || numFrames == 0) {
+        if (currentValue != 1.0f)
+            FloatVectorOperations::multiply(buffer, currentValue, (int)numFrames);
+
+        return;
+    }
+
+    float laneDecay{};
+    auto lanes{ initRampLanes(currentValue - targetValue, 1.0f - frac, laneDecay) };
+
+    size_t i{};
+
+    for (; i + LANES <= numFrames; i += LANES) {
+        for (size_t j = 0; j < LANES; ++j) {
+            buffer[i + j] *= targetValue + lanes[j];
+            lanes[j] *= laneDecay;
+        }
+    }
+
+    for (size_t j = 0; i < numFrames; ++i, ++j)
+        buffer[i] *= targetValue + lanes[j];
+
+    // Distance to the target after the last sample
+    currentValue = targetValue + (currentValue - targetValue) * std::pow(1.0f - frac, (float)numFrames);
+    updateSmoothing();
+}
+
+size_t Parameter::advanceRamp(size_t numFrames)
+{
+    if (rampRemaining == 0)
+        return numFrames;
+
+    if (numFrames < rampRemaining) {
+        currentValue += rampStep * (float)numFrames;
+        rampRemaining -= numFrames;
+        return 0;
+    }
+
+    // Land exactly on the target, the rest is left to the smoothing
+    currentValue = targetValue;
+    numFrames -= rampRemaining;
+    rampRemaining = 0;
+
+    return numFrames;
 }
 
 void Parameter::updateSmoothing()
@@ -14,6 +14,13 @@ public:
     const juce::String& getName() const noexcept { return name; }
     void setValue(float v, float s, bool force = false);
     void setValue(float v, bool force = false);
+
+    /**
+     * Move linearly to the value over the given number of samples.
+     * This replaces the exponential smoothing until the value is reached,
+     * setting a value cancels the ramp.
+     */
+    void rampTo(float v, size_t numFrames);
     void setSmoothing(float s) noexcept;
     void setRange(float min, float max);
 
@@ -23,17 +30,28 @@ public:
     float getTargetValue() const noexcept { return targetValue; }
     float getMin() const noexcept { return minValue; }
     float getMax() const noexcept { return maxValue; }
-    bool isSmoothing() const noexcept { return smoothing || currentValue != targetValue; }
+    bool isSmoothing() const noexcept { return smoothing || rampRemaining > 0 || currentValue != targetValue; }
 
     float getNextValue();
+
+    /** Advance the smoothing by a number of samples at once. */
     float getNextValue(size_t numFrames);
 
+    /** Fill the buffer with the next smoothed values. */
+    void getNextValues(float* out, size_t numFrames);
+
+    /** Multiply the buffer by the next smoothed values. */
+    void applyGain(float* buffer, size_t numFrames);
+
     float& targetRef() noexcept { return targetValue; }
 
 private:
 
     void updateSmoothing();
 
+    /* Advance the linear ramp, returns the number of samples left after it */
+    size_t advanceRamp(size_t numFrames);
+
     String name{};
     float currentValue{};
     float minValue{};
@@ -41,6 +59,8 @@ private:
     float targetValue{ 0.0f };
     float frac{};
     bool smoothing{};
+    float rampStep{};
+    size_t rampRemaining{};
 };
 
 //==============================================================================
@@ -0,0 +1,244 @@
+#include "engine/PhonemeInventory.h"
+
+namespace engine {
+
+struct DefaultPhoneme
+{
+    const char* symbol;
+    model::VoiceProcessor::ControlPoint controlPoint;
+};
+
+const static DefaultPhoneme defaultPhonemes[] {
+  /*        tongX  tongY  consX  consY  tens     */
+    { "a", { 0.20f, 0.19f, 0.80f, 0.00f, 0.60f } },
+    { "i", { 1.00f, 0.05f, 0.76f, 0.68f, 0.60f } },
+    { "y", { 1.00f, 0.20f, 0.50f, 0.70f, 0.60f } },
+    { "u", { 0.60f, 0.00f, 0.91f, 0.68f, 0.60f } },
+    { "e", { 0.55f, 0.80f, 0.00f, 0.00f, 0.60f } },
+    { "o", { 0.00f, 0.00f, 0.86f, 0.85f, 0.60f } },
+    { "l", { 0.20f, 0.19f, 0.82f, 0.70f, 0.60f } },
+    { "s", { 0.87f, 0.22f, 0.83f, 0.64f, 0.00f } },
+    { "z", { 0.87f, 0.22f, 0.83f, 0.63f, 0.87f } },
+    { "k", { 0.00f, 0.00f, 0.21f, 0.09f, 0.60f } },
+    { "q", { 0.87f, 0.76f, 0.21f, 0.09f, 0.33f } },
+    { "g", { 0.00f, 0.00f, 0.65f, 0.40f, 0.60f } },
+    { "m", { 0.20f, 0.10f, 0.95f, 0.12f, 0.60f } },
+    { "n", { 0.88f, 0.50f, 0.83f, 0.10f, 0.74f } },
+    { "p", { 0.00f, 0.00f, 0.81f, 0.40f, 0.60f } },
+    { "b", { 0.00f, 0.00f, 0.76f, 0.57f, 0.60f } },
+    { "r", { 0.00f, 0.20f, 0.55f, 0.68f, 0.60f } },
+    { "v", { 0.95f, 0.20f, 0.97f, 0.67f, 0.70f } },
+    { "f", { 0.95f, 0.20f, 0.97f, 0.75f, 0.00f } },
+    { "d", { 0.89f, 0.37f, 0.91f, 0.60f, 0.74f } },
+    { "t", { 0.95f, 0.88f, 0.94f, 0.58f, 0.00f } },
+    { "c", { 0.50f, 0.21f, 0.74f, 0.58f, 0.56f } },
+    { "h", { 0.00f, 1.00f, 0.10f, 0.59f, 0.02f } },
+    { "j", { 0.26f, 0.48f, 0.71f, 0.61f, 0.91f } },
+    { "w", { 0.00f, 0.50f, 0.95f, 0.68f, 0.41f } },
+    { "x", { 0.53f, 0.47f, 0.13f, 0.09f, 0.60f } }
+};
+
+//==============================================================================
+
+PhonemeInventory::PhonemeInventory()
+{
+    // Slot zero is taken by the unknown phoneme
+    numPhonemes = 1;
+    table.startWaveforms[UNKNOWN_PHONEME] = model::Glottis::makeWaveform(table.controlPoints[UNKNOWN_PHONEME].tenseness);
+}
+
+PhonemeInventory::Ptr PhonemeInventory::createDefault()
+{
+    auto inventory{ std::make_shared<PhonemeInventory>() };
+
+    for (const auto& phoneme : defaultPhonemes) {
+        [[maybe_unused]] const auto res{ inventory->add(phoneme.symbol, phoneme.controlPoint) };
+        jassert(res.wasOk());
+    }
+
+    return inventory;
+}
+
+Result PhonemeInventory::add(const String& symbol, const ControlPoint& cp)
+{
+    const String trimmed{ symbol.trim() };
+    const auto length{ (size_t)trimmed.getNumBytesAsUTF8() };
+
+    if (length == 0 || length > MAX_SYMBOL_LENGTH)
+        return Result::fail("Invalid phoneme symbol '" + symbol + "'");
+
+    // Fold the case the way the lyrics do, so that the symbol matches them
+    Symbol s{};
+    const char* utf8{ trimmed.toRawUTF8() };
+
+    for (size_t i = 0; i < length; ++i) {
+        s[i] = toLowerASCII(utf8[i]);
+
+        if ((uint8)s[i] < 0x80 && (s[i] < 'a' || s[i] > 'z'))
+            return Result::fail("Phoneme symbol '" + symbol + "' may only use letters");
+    }
+
+    const char* str{ s.data() };
+    Id id{};
+
+    if (parse(std::string_view(str, length), id) == length && id != UNKNOWN_PHONEME) {
+        // Redefine an existing phoneme
+        table.controlPoints[id] = cp;
+        table.startWaveforms[id] = model::Glottis::makeWaveform(cp.tenseness);
+        return Result::ok();
+    }
+
+    if (numPhonemes >= MAX_PHONEMES)
+        return Result::fail("Too many phonemes");
+
+    id = (Id)numPhonemes++;
+
+    std::copy(str, str + length, symbols[id].begin());
+    symbols[id][length] = '\0';
+    table.controlPoints[id] = cp;
+    table.startWaveforms[id] = model::Glottis::makeWaveform(cp.tenseness);
+
+    if (length == 1)
+        singleCharIds[(uint8)str[0]] = id;
+
+    for (size_t pos = 0; pos < length;) {
+        juce_wchar c{};
+        pos += decodeCharacter(std::string_view(str + pos, length - pos), c);
+
+        if (c >= 0x80 && !isSymbolCharacter(c))
+            extendedChars.push_back(c);
+    }
+
+    maxSymbolLength = jmax(maxSymbolLength, length);
+
+    return Result::ok();
+}
+
+Result PhonemeInventory::loadFromJSON(const String& json)
+{
+    var root{};
+    const auto res{ JSON::parse(json, root) };
+
+    if (res.failed())
+        return res;
+
+    const auto* phonemes{ root.getProperty("phonemes", var()).getArray() };
+
+    if (phonemes == nullptr)
+        return Result::fail("Phonemes array is missing");
+
+    for (const auto& phoneme : *phonemes) {
+        if (!phoneme.isObject())
+            return Result::fail("Invalid phoneme definition");
+
+        ControlPoint cp{};
+        cp.tongueX = phoneme.getProperty("tongueX", 0.0f);
+        cp.tongueY = phoneme.getProperty("tongueY", 0.0f);
+        cp.constrictionX = phoneme.getProperty("constrictionX", 0.0f);
+        cp.constrictionY = phoneme.getProperty("constrictionY", 0.0f);
+        cp.tenseness = phoneme.getProperty("tenseness", 0.0f);
+
+        const auto addRes{ add(phoneme.getProperty("symbol", String()).toString(), cp) };
+
+        if (addRes.failed())
+            return addRes;
+    }
+
+    return Result::ok();
+}
+
+Result PhonemeInventory::loadFromFile(const File& file)
+{
+    if (!file.existsAsFile())
+        return Result::fail("File " + file.getFullPathName() + " does not exist");
+
+    return loadFromJSON(file.loadFileAsString());
+}
+
+size_t PhonemeInventory::parse(std::string_view str, Id& id) const
+{
+    id = UNKNOWN_PHONEME;
+
+    if (str.empty())
+        return 0;
+
+    // Multi-character symbols take precedence, the longest one wins
+    size_t bestLength{ 0 };
+
+    if (maxSymbolLength > 1) {
+        for (size_t i = 1; i < numPhonemes; ++i) {
+            const auto& symbol{ symbols[i] };
+            size_t length{ 0 };
+
+            while (symbol[length] != '\0' && length < str.size() && symbol[length] == str[length])
+                ++length;
+
+            if (symbol[length] == '\0' && length > 1 && length > bestLength) {
+                bestLength = length;
+                id = (Id)i;
+            }
+        }
+    }
+
+    if (bestLength > 0)
+        return bestLength;
+
+    id = singleCharIds[(uint8)str[0]];
+
+    if (id != UNKNOWN_PHONEME)
+        return 1;
+
+    // A character that is not a symbol is a single unknown phoneme, whatever its length
+    juce_wchar c{};
+    return decodeCharacter(str, c);
+}
+
+bool PhonemeInventory::isSymbolCharacter(juce_wchar c) const
+{
+    return std::find(extendedChars.begin(), extendedChars.end(), c) != extendedChars.end();
+}
+
+size_t PhonemeInventory::decodeCharacter(std::string_view str, juce_wchar& c)
+{
+    constexpr juce_wchar replacementChar{ 0xfffd };
+
+    c = 0;
+
+    if (str.empty())
+        return 0;
+
+    const auto lead{ (uint8)str[0] };
+    size_t length{};
+
+    if (lead < 0x80) {
+        c = lead;
+        return 1;
+    } else if ((lead & 0xe0) == 0xc0) {
+        c = lead & 0x1f;
+        length = 2;
+    } else if ((lead & 0xf0) == 0xe0) {
+        c = lead & 0x0f;
+        length = 3;
+    } else if ((lead & 0xf8) == 0xf0) {
+        c = lead & 0x07;
+        length = 4;
+    } else {
+        // Stray continuation byte
+        c = replacementChar;
+        return 1;
+    }
+
+    for (size_t i = 1; i < length; ++i) {
+        if (i >= str.size() || ((uint8)str[i] & 0xc0) != 0x80) {
+            // Truncated sequence, skip what has been read
+            c = replacementChar;
+            return i;
+        }
+
+        c = (c << 6) | ((uint8)str[i] & 0x3f);
+    }
+
+    return length;
+}
+
+} // namespace engine
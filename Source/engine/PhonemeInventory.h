@@ -0,0 +1,108 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "core/CacheLine.h"
+#include "model/VoiceProcessor.h"
+#include <array>
+#include <string_view>
+#include <vector>
+
+namespace engine {
+
+/**
+ * Set of phonemes the voices can articulate.
+ *
+ * Each phoneme is identified by a symbol of one or more characters,
+ * which gets resolved into an integer ID when the lyrics are parsed.
+ * The IDs index a flat table of the vocal tract control points.
+ *
+ * An inventory is immutable once handed over to the engine,
+ * a new one must be created in order to change the phonemes.
+ */
+class PhonemeInventory final
+{
+public:
+    using Ptr = std::shared_ptr<PhonemeInventory>;
+    using ControlPoint = model::VoiceProcessor::ControlPoint;
+    using Waveform = model::Glottis::Waveform;
+    using Id = uint8;
+
+    constexpr static size_t MAX_PHONEMES = 256;
+    constexpr static size_t MAX_SYMBOL_LENGTH = 4;
+
+    /** Unknown symbols resolve to this phoneme, which has a neutral control point. */
+    constexpr static Id UNKNOWN_PHONEME = 0;
+
+    PhonemeInventory();
+
+    /** Create the inventory the vocal model has been tuned with. */
+    static Ptr createDefault();
+
+    /**
+     * Add or redefine a phoneme.
+     * Symbols are lower-cased the same way as the lyrics, only ASCII letters
+     * get folded. The other ASCII characters separate the words of the lyrics,
+     * so symbols using digits, punctuation or dashes are rejected.
+     */
+    Result add(const String& symbol, const ControlPoint& cp);
+
+    /**
+     * Load phonemes from a JSON document like:
+     * { "phonemes": [ { "symbol": "a", "tongueX": 0.2, "tongueY": 0.19,
+     *                   "constrictionX": 0.8, "constrictionY": 0.0, "tenseness": 0.6 }, ... ] }
+     */
+    Result loadFromJSON(const String& json);
+    Result loadFromFile(const File& file);
+
+    /**
+     * Resolve the longest phoneme symbol at the beginning of the string.
+     * Returns the number of bytes consumed, which is zero only for an empty string.
+     * This does not allocate.
+     */
+    size_t parse(std::string_view str, Id& id) const;
+
+    /**
+     * Tells whether a phoneme symbol uses the given non-ASCII character.
+     * Lyrics split words on the non-ASCII characters that none of the symbols use.
+     */
+    bool isSymbolCharacter(juce_wchar c) const;
+
+    /**
+     * Decode the UTF-8 character at the beginning of the string.
+     * Returns its length in bytes, which is zero only for an empty string.
+     * Invalid sequences decode into the replacement character.
+     */
+    static size_t decodeCharacter(std::string_view str, juce_wchar& c);
+
+    /** Lower-case an ASCII letter, other bytes are left as they are. */
+    static char toLowerASCII(char c) { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; }
+
+    const ControlPoint& operator[](Id id) const { return table.controlPoints[id]; }
+
+    /** Glottal waveform shape for the phoneme's tenseness, voices start from it. */
+    const Waveform& getStartWaveform(Id id) const { return table.startWaveforms[id]; }
+
+    size_t size() const { return numPhonemes; }
+
+private:
+
+    struct alignas(core::CACHE_LINE_SIZE) Table
+    {
+        std::array<ControlPoint, MAX_PHONEMES> controlPoints{};
+        std::array<Waveform, MAX_PHONEMES> startWaveforms{};
+    };
+
+    using Symbol = std::array<char, MAX_SYMBOL_LENGTH + 1>;
+
+    Table table{};
+
+    std::array<Symbol, MAX_PHONEMES> symbols{};
+    std::array<Id, 256> singleCharIds{};
+    std::vector<juce_wchar> extendedChars{};   // Non-ASCII characters used by the symbols
+    size_t numPhonemes{};
+    size_t maxSymbolLength{};
+
+    JUCE_LEAK_DETECTOR(PhonemeInventory)
+};
+
+} // namespace engine
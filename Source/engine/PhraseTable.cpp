@@ -0,0 +1,151 @@
+#include "engine/PhraseTable.h"
+
+namespace engine {
+
+static std::atomic<uint32> nextRevision{ 1 };
+
+PhraseTable::PhraseTable(const PhonemeInventory::Ptr& inv)
+    : inventory{ inv }
+    , revision{ nextRevision.fetch_add(1) }
+{
+    jassert(inventory != nullptr);
+}
+
+void PhraseTable::compile(const Lyrics& lyrics)
+{
+    phonemes.clear();
+    phrases.clear();
+    phrases.reserve(lyrics.size());
+
+    basePatches.clear();
+
+    for (size_t i = 0; i < lyrics.size(); ++i)
+        append(lyrics[i]);
+
+    phonemes.shrink_to_fit();
+}
+
+void PhraseTable::compile(const PhraseTable& previous, const Lyrics& lyrics, const Lyrics::Patch& p)
+{
+    jassert(&previous != this);
+    jassert(previous.inventory == inventory);
+    jassert(p.firstPhrase + p.numRemoved <= previous.phrases.size());
+    jassert(previous.phrases.size() - p.numRemoved + p.numInserted == lyrics.size());
+
+    phonemes.clear();
+    phrases.clear();
+    phrases.reserve(lyrics.size());
+
+    const auto firstKept{ previous.phrases.begin() + (std::ptrdiff_t)(p.firstPhrase + p.numRemoved) };
+    const auto editOffset{ p.firstPhrase < previous.phrases.size() ? previous.phrases[p.firstPhrase].offset : (uint32)previous.phonemes.size() };
+    const auto keptOffset{ firstKept != previous.phrases.end() ? firstKept->offset : (uint32)previous.phonemes.size() };
+
+    // Phrases before the edit are copied as they are
+    phrases.insert(phrases.end(), previous.phrases.begin(), previous.phrases.begin() + (std::ptrdiff_t)p.firstPhrase);
+    phonemes.insert(phonemes.end(), previous.phonemes.begin(), previous.phonemes.begin() + editOffset);
+
+    for (size_t i = p.firstPhrase; i < p.firstPhrase + p.numInserted; ++i)
+        append(lyrics[i]);
+
+    // Phrases after the edit have their phonemes shifted
+    const auto shift{ (uint32)phonemes.size() - keptOffset };
+
+    for (auto it = firstKept; it != previous.phrases.end(); ++it) {
+        phrases.push_back(*it);
+        phrases.back().offset += shift;
+    }
+
+    phonemes.insert(phonemes.end(), previous.phonemes.begin() + keptOffset, previous.phonemes.end());
+    phonemes.shrink_to_fit();
+
+    // Keep the edits made since the older tables, so that a table still in use
+    // can be remapped even if the ones in between have never been adopted
+    const size_t numKept{ jmin(previous.basePatches.size(), maxBasePatches - 1) };
+
+    basePatches.assign(previous.basePatches.end() - (std::ptrdiff_t)numKept, previous.basePatches.end());
+    basePatches.push_back({ previous.revision, p });
+}
+
+size_t PhraseTable::remapPhraseIndex(uint32 rev, size_t index) const
+{
+    const size_t first{ findBasePatch(rev) };
+    jassert(first < basePatches.size());
+
+    for (size_t i = first; i < basePatches.size(); ++i) {
+        const auto& patch{ basePatches[i].patch };
+
+        if (index < patch.firstPhrase)
+            continue;
+
+        if (index >= patch.firstPhrase + patch.numRemoved)
+            index = index - patch.numRemoved + patch.numInserted;
+        else
+            index = patch.firstPhrase;
+    }
+
+    return index;
+}
+
+size_t PhraseTable::findBasePatch(uint32 rev) const
+{
+    for (size_t i = 0; i < basePatches.size(); ++i) {
+        if (basePatches[i].revision == rev)
+            return i;
+    }
+
+    return basePatches.size();
+}
+
+Voice::Phrase PhraseTable::operator[](size_t index) const
+{
+    jassert(index < phrases.size());
+
+    const auto& entry{ phrases[index] };
+    const auto* attack{ phonemes.data() + entry.offset };
+
+    Voice::Phrase phrase{};
+    phrase.table = this;
+    phrase.attack = { attack, entry.numAttackPhonemes, entry.attackLength };
+    phrase.release = { attack + entry.numAttackPhonemes, entry.numReleasePhonemes, entry.releaseLength };
+
+    return phrase;
+}
+
+void PhraseTable::append(const Lyrics::Phrase& phrase)
+{
+    Entry entry{};
+    entry.offset = (uint32)phonemes.size();
+    entry.numAttackPhonemes = append(phrase.attack, entry.attackLength);
+
+    if (entry.numAttackPhonemes == 0) {
+        // Voices need something to sustain
+        phonemes.push_back({ PhonemeInventory::UNKNOWN_PHONEME, Voice::getDefaultPhonemeDuration() });
+        entry.numAttackPhonemes = 1;
+        entry.attackLength = phonemes.back().duration;
+    }
+
+    entry.numReleasePhonemes = append(phrase.release, entry.releaseLength);
+
+    phrases.push_back(entry);
+}
+
+uint32 PhraseTable::append(std::string_view str, uint32& length)
+{
+    uint32 numPhonemes{};
+    length = 0;
+
+    while (!str.empty()) {
+        Voice::Phoneme phoneme{};
+        phoneme.duration = Voice::getDefaultPhonemeDuration();
+
+        str.remove_prefix(inventory->parse(str, phoneme.id));
+        phonemes.push_back(phoneme);
+
+        length += phoneme.duration;
+        ++numPhonemes;
+    }
+
+    return numPhonemes;
+}
+
+} // namespace engine
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "engine/Lyrics.h"
+#include "engine/PhonemeInventory.h"
+#include "engine/Voice.h"
+#include <vector>
+
+namespace engine {
+
+/**
+ * Lyrics compiled into the voice phrases.
+ *
+ * Phonemes of all the phrases are stored in a single contiguous buffer,
+ * and each phrase refers to its range in there, so the memory footprint
+ * follows the size of the lyrics. The table is built outside of the audio
+ * thread and is immutable once handed over, so that switching the lyrics
+ * is a pointer swap.
+ */
+class PhraseTable final
+{
+public:
+    using Ptr = std::shared_ptr<const PhraseTable>;
+
+    PhraseTable(const PhonemeInventory::Ptr& inv);
+
+    void compile(const Lyrics& lyrics);
+
+    /**
+     * Compile edited lyrics reusing the unchanged phrases of the previous table.
+     * The phrase index of the previous table can then be mapped onto this one.
+     */
+    void compile(const PhraseTable& previous, const Lyrics& lyrics, const Lyrics::Patch& patch);
+
+    size_t size() const { return phrases.size(); }
+
+    /** Returns a phrase view, valid as long as this table is alive. */
+    Voice::Phrase operator[](size_t index) const;
+
+    const PhonemeInventory& getInventory() const { return *inventory; }
+    const PhonemeInventory::Ptr& getInventoryPtr() const { return inventory; }
+
+    /** Unique table identifier. */
+    uint32 getRevision() const { return revision; }
+
+    /**
+     * Tells whether this table has been patched from the one with the given
+     * revision, either directly or through the tables compiled in between.
+     */
+    bool isPatchOf(uint32 rev) const { return findBasePatch(rev) < basePatches.size(); }
+
+    /**
+     * Map a phrase index of the table with the given revision onto this table,
+     * going through all the edits made since then. The revision must be one
+     * this table is a patch of. Indices within an edited range point to the
+     * first edited phrase.
+     */
+    size_t remapPhraseIndex(uint32 rev, size_t index) const;
+
+    /** Number of consecutive edits a table keeps track of. */
+    constexpr static size_t maxBasePatches = 16;
+
+private:
+
+    struct Entry
+    {
+        uint32 offset{};        // First attack phoneme, release phonemes follow
+        uint32 numAttackPhonemes{};
+        uint32 numReleasePhonemes{};
+        uint32 attackLength{};  // [samples]
+        uint32 releaseLength{}; // [samples]
+    };
+
+    /* Edit that turned the table of the given revision into the next one */
+    struct BasePatch
+    {
+        uint32 revision{};
+        Lyrics::Patch patch{};
+    };
+
+    void append(const Lyrics::Phrase& phrase);
+    uint32 append(std::string_view str, uint32& length);
+    size_t findBasePatch(uint32 rev) const;
+
+    PhonemeInventory::Ptr inventory;
+    uint32 revision;
+
+    /* Edits since the base tables, oldest first. The last one has been made to the previous table. */
+    std::vector<BasePatch> basePatches{};
+
+    std::vector<Voice::Phoneme> phonemes{};
+    std::vector<Entry> phrases{};
+
+    JUCE_DECLARE_NON_COPYABLE(PhraseTable)
+};
+
+} // namespace engine
@@ -1,83 +1,21 @@
 #include "engine/Voice.h"
 #include "engine/Engine.h"
-#include <map>
+#include "engine/PhraseTable.h"
 
 namespace engine {
 
-const static std::map<char, model::VoiceProcessor::ControlPoint> phonemes {
-  /*         tongX  tongY  consX  consY  tens     */
-    { 'a', { 0.20f, 0.19f, 0.80f, 0.00f, 0.60f } },
-    { 'i', { 1.00f, 0.05f, 0.76f, 0.68f, 0.60f } },
-    { 'y', { 1.00f, 0.20f, 0.50f, 0.70f, 0.60f } },
-    { 'u', { 0.60f, 0.00f, 0.91f, 0.68f, 0.60f } },
-    { 'e', { 0.55f, 0.80f, 0.00f, 0.00f, 0.60f } },
-    { 'o', { 0.00f, 0.00f, 0.86f, 0.85f, 0.60f } },
-    { 'l', { 0.20f, 0.19f, 0.82f, 0.70f, 0.60f } },
-    { 's', { 0.87f, 0.22f, 0.83f, 0.64f, 0.00f } },
-    { 'z', { 0.87f, 0.22f, 0.83f, 0.63f, 0.87f } },
-    { 'k', { 0.00f, 0.00f, 0.21f, 0.09f, 0.60f } },
-    { 'q', { 0.87f, 0.76f, 0.21f, 0.09f, 0.33f } },
-    { 'g', { 0.00f, 0.00f, 0.65f, 0.40f, 0.60f } },
-    { 'm', { 0.20f, 0.10f, 0.95f, 0.12f, 0.60f } },
-    { 'n', { 0.88f, 0.50f, 0.83f, 0.10f, 0.74f } },
-    { 'p', { 0.00f, 0.00f, 0.81f, 0.40f, 0.60f } },
-    { 'b', { 0.00f, 0.00f, 0.76f, 0.57f, 0.60f } },
-    { 'r', { 0.00f, 0.20f, 0.55f, 0.68f, 0.60f } },
-    { 'v', { 0.95f, 0.20f, 0.97f, 0.67f, 0.70f } },
-    { 'f', { 0.95f, 0.20f, 0.97f, 0.75f, 0.00f } },
-    { 'd', { 0.89f, 0.37f, 0.91f, 0.60f, 0.74f } },
-    { 't', { 0.95f, 0.88f, 0.94f, 0.58f, 0.00f } },
-    { 'c', { 0.50f, 0.21f, 0.74f, 0.58f, 0.56f } },
-    { 'h', { 0.00f, 1.00f, 0.10f, 0.59f, 0.02f } },
-    { 'j', { 0.26f, 0.48f, 0.71f, 0.61f, 0.91f } },
-    { 'w', { 0.00f, 0.50f, 0.95f, 0.68f, 0.41f } },
-    { 'x', { 0.53f, 0.47f, 0.13f, 0.09f, 0.60f } }
-};
-
-static const model::VoiceProcessor::ControlPoint& getControlPointForPhoneme(char sym)
-{
-    const static model::VoiceProcessor::ControlPoint dummy{};
-
-    auto it{ phonemes.find(sym) };
-
-    if (it != phonemes.end())
-        return it->second;
-
-    return dummy;
-}
-
 static float getNoteFrequency(int noteNumber)
 {
     return 440.0f * powf(2.0f, float(noteNumber - 69) / 12.0f);
 }
 
-template<size_t S>
-static size_t phonemesFromString(const String& str, std::array<Voice::Phoneme, S>& target)
-{
-    const char* aStr{ str.getCharPointer().getAddress() };
-    size_t i = 0;
-
-    while (i < target.size() && aStr[i] != '\0') {
-        target[i].symbol = aStr[i];
-        ++i;
-    }
-
-    return i;
-}
-
 //==============================================================================
 
-void Voice::Phrase::parse(const String& a, const String& r)
+uint32 Voice::getDefaultPhonemeDuration()
 {
-    const char* aStr{ a.getCharPointer().getAddress() };
-    const char* rStr{ r.getCharPointer().getAddress() };
-
-    numAttackPhonemes = phonemesFromString(aStr, attack);
-    numReleasePhonemes = phonemesFromString(rStr, release);
+    return (uint32)(Engine::INTERNAL_SAMPLE_RATE * DEFAULT_PHONEME_DURATION);
 }
 
-//==============================================================================
-
 Voice::Voice(Engine& eng)
     : engine{ eng }
 {
@@ -92,17 +30,19 @@ void Voice::trigger(const Trigger& t)
 {
     triggerRecord = t;
 
-    jassert(triggerRecord.phrase.numAttackPhonemes > 0);
+    jassert(triggerRecord.delay < MAX_OUTPUT_DELAY);
+    outputDelay = jmin(triggerRecord.delay, MAX_OUTPUT_DELAY - 1);
+    delayLine.fill(0.0f);
+
+    jassert(triggerRecord.phrase.table != nullptr);
+    jassert(triggerRecord.phrase.attack.numPhonemes > 0);
 
     attackPhase = true;
-    phonemeIndex = 0;
-    generatedSamplesInPhoneme = 0;
-    totalSamplesInPhoneme = Engine::INTERNAL_SAMPLE_RATE * triggerRecord.phrase.attack[0].duration;
+    startTimeline();
 
     voiceProcessor.setFrequency(getNoteFrequency(triggerRecord.key), true);
-
-    const auto cp{ getControlPointForPhoneme(triggerRecord.phrase.attack[0].symbol) };
-    voiceProcessor.trigger(cp);
+    const auto& phoneme{ triggerRecord.phrase.attack.phonemes[0] };
+    voiceProcessor.trigger(getControlPoint(phoneme), triggerRecord.phrase.table->getInventory().getStartWaveform(phoneme.id));
 
     envelope.trigger(triggerRecord.envelope);
 }
@@ -111,31 +51,44 @@ void Voice::retrigger(const Trigger& t)
 {
     triggerRecord = t;
 
-    jassert(triggerRecord.phrase.numAttackPhonemes > 0);
+    jassert(triggerRecord.phrase.table != nullptr);
+    jassert(triggerRecord.phrase.attack.numPhonemes > 0);
 
     attackPhase = true;
-    phonemeIndex = 0;
-    generatedSamplesInPhoneme = 0;
-    totalSamplesInPhoneme = Engine::INTERNAL_SAMPLE_RATE * triggerRecord.phrase.attack[0].duration;
+    startTimeline();
 
     voiceProcessor.setFrequency(getNoteFrequency(triggerRecord.key), false);
-
-    const auto cp{ getControlPointForPhoneme(triggerRecord.phrase.attack[0].symbol) };
-    voiceProcessor.retrigger(cp);
+    voiceProcessor.retrigger(getControlPoint(triggerRecord.phrase.attack.phonemes[0]));
     voiceProcessor.setVibrato(0.0f);
 
     envelope.retrigger();
 }
 
+void Voice::steal(const Trigger& t)
+{
+    stealTrigger = t;
+    releasePending = false;
+
+    if (!stealing) {
+        stealing = true;
+        stealFade = 1.0f;
+        stealFadeStep = 1.0f / (STEAL_FADE_TIME * Engine::INTERNAL_SAMPLE_RATE);
+    }
+}
+
 void Voice::release()
 {
-    if (triggerRecord.phrase.numReleasePhonemes > 0) {
+    if (stealing) {
+        // The new note has been released before the voice got retriggered
+        releasePending = true;
+        return;
+    }
+
+    if (triggerRecord.phrase.release.numPhonemes > 0) {
         attackPhase = false;
-        phonemeIndex = 0;
-        generatedSamplesInPhoneme = 0;
+        startTimeline();
 
-        const auto cp{ getControlPointForPhoneme(triggerRecord.phrase.release[0].symbol) };
-        voiceProcessor.setControlPoint(cp);
+        voiceProcessor.setControlPoint(getControlPoint(triggerRecord.phrase.release.phonemes[0]));
 
         // Cancel vibrato on release
         voiceProcessor.setVibrato(0.0f);
@@ -146,61 +99,137 @@ void Voice::release()
     }
 }
 
-void Voice::process(float* outL, float* outR, size_t numFrames)
+void Voice::process(float* out, size_t numFrames, float vibrato)
+{
+    if (outputDelay == 0) {
+        renderFrames(out, numFrames, vibrato);
+        return;
+    }
+
+    std::array<float, Engine::SUB_FRAME_LENGTH> buffer{};
+    jassert(numFrames <= buffer.size() && outputDelay < numFrames);
+
+    // Delay may change if the voice gets retriggered on steal
+    const size_t delay{ jmin(outputDelay, numFrames) };
+
+    FloatVectorOperations::add(out, delayLine.data(), (int)delay);
+
+    renderFrames(buffer.data(), numFrames, vibrato);
+
+    FloatVectorOperations::add(out + delay, buffer.data(), (int)(numFrames - delay));
+    FloatVectorOperations::copy(delayLine.data(), buffer.data() + numFrames - delay, (int)delay);
+}
+
+void Voice::renderFrames(float* out, size_t numFrames, float vibrato)
 {
-    voiceProcessor.setVibrato(engine.getParameters()[Engine::PARAM_VIBRATO].getCurrentValue());
-    voiceProcessor.process(outL, (int)numFrames);
+    std::array<float, Engine::SUB_FRAME_LENGTH> gain{};
+    jassert(numFrames <= gain.size());
 
-    // Apply envelope and velocity
-    for (size_t i = 0; i < numFrames; ++i) {
-        outL[i] *= envelope.getNext() * triggerRecord.velocity;
+    // Envelope and velocity
+    envelope.render(gain.data(), numFrames, triggerRecord.velocity);
+
+    if (stealing) {
+        for (size_t i = 0; i < numFrames; ++i) {
+            gain[i] *= stealFade;
+            stealFade = jmax(0.0f, stealFade - stealFadeStep);
+        }
     }
 
-    if (outR != outL)
-        memcpy(outR, outL, sizeof(float) * numFrames);
-
-    generatedSamplesInPhoneme += numFrames;
-
-    if (generatedSamplesInPhoneme >= totalSamplesInPhoneme) {
-        // @note This will consume some time from the next phoneme to make transisions block-aligned
-        generatedSamplesInPhoneme -= totalSamplesInPhoneme;
-
-        if (attackPhase) {
-            if (phonemeIndex < triggerRecord.phrase.numAttackPhonemes - 1) {
-                ++phonemeIndex;
-                const char nextSymbol{ triggerRecord.phrase.attack[phonemeIndex].symbol };
-                const auto cp{ getControlPointForPhoneme(nextSymbol) };
-                voiceProcessor.setControlPoint(cp);
-                totalSamplesInPhoneme = Engine::INTERNAL_SAMPLE_RATE * triggerRecord.phrase.attack[phonemeIndex].duration;
-            } else {
-                // Sustain the last phoneme
-                if (vibratoLevel < 1.0f) {
-                    vibratoLevel += 0.01f + vibratoLevel * 0.02f;
-                    vibratoLevel = jlimit(0.0f, 1.0f, vibratoLevel);
-                }
-
-                voiceProcessor.setVibrato(vibratoLevel);
-            }
-        } else {
-            if (phonemeIndex < triggerRecord.phrase.numReleasePhonemes - 1) {
-                ++phonemeIndex;
-                const char nextSymbol{ triggerRecord.phrase.release[phonemeIndex].symbol };
-                const auto cp{ getControlPointForPhoneme(nextSymbol) };
-                voiceProcessor.setControlPoint(cp);
-                totalSamplesInPhoneme = Engine::INTERNAL_SAMPLE_RATE * triggerRecord.phrase.release[phonemeIndex].duration;
-            } else {
-                // Release on the last phoneme
-                envelope.release();
-                //voiceProcessor.release();
-                generatedSamplesInPhoneme = 0;
-            }
+    voiceProcessor.setVibrato(vibrato);
+    voiceProcessor.process(out, gain.data(), (int)numFrames);
+
+    if (stealing && (stealFade <= 0.0f || envelope.getState() == Envelope::State::Off)) {
+        // Faded out, restart the voice with the new note
+        stealing = false;
+        vibratoLevel = 0.0f;
+
+        // Keep the sub-frame alignment, the new note starts when the fade is over
+        stealTrigger.delay = outputDelay;
+        trigger(stealTrigger);
+
+        if (releasePending) {
+            releasePending = false;
+            release();
         }
+
+        return;
     }
 
+    advanceTimeline(numFrames);
+
     if (isOver())
         voiceProcessor.release();
 }
 
+const model::VoiceProcessor::ControlPoint& Voice::getControlPoint(const Phoneme& phoneme) const
+{
+    return triggerRecord.phrase.table->getInventory()[phoneme.id];
+}
+
+void Voice::startTimeline()
+{
+    // The first phoneme gets applied by the caller
+    const auto& timeline{ getTimeline() };
+
+    timelinePosition = 0;
+    nextTimelineEvent = 1;
+    nextTimelineEventTime = timeline.numPhonemes > 0 ? timeline.phonemes[0].duration : 0;
+    nextTimelineMark = timeline.length;
+}
+
+void Voice::advanceTimeline(size_t numFrames)
+{
+    // Events are applied at the end of the sub-frame they fall into,
+    // the model picks up the control point on the next sub-frame.
+    const auto& timeline{ getTimeline() };
+    timelinePosition += numFrames;
+
+    while (nextTimelineEvent < timeline.numPhonemes && nextTimelineEventTime <= timelinePosition) {
+        const auto& phoneme{ timeline.phonemes[nextTimelineEvent] };
+        voiceProcessor.setControlPoint(getControlPoint(phoneme));
+        nextTimelineEventTime += phoneme.duration;
+        ++nextTimelineEvent;
+    }
+
+    if (timelinePosition < nextTimelineMark)
+        return;
+
+    if (attackPhase) {
+        // Sustain the last phoneme, vibrato builds up once per phoneme duration
+        if (vibratoLevel < 1.0f) {
+            vibratoLevel += 0.01f + vibratoLevel * 0.02f;
+            vibratoLevel = jlimit(0.0f, 1.0f, vibratoLevel);
+        }
+
+        voiceProcessor.setVibrato(vibratoLevel);
+        nextTimelineMark += timeline.phonemes[timeline.numPhonemes - 1].duration;
+    } else {
+        // Release on the last phoneme
+        envelope.release();
+        //voiceProcessor.release();
+        nextTimelineMark = std::numeric_limits<size_t>::max();
+    }
+}
+
+Voice::Articulation Voice::getArticulation() const
+{
+    if (stealing)
+        return Articulation::Stealing;
+
+    if (!attackPhase || isReleasing())
+        return Articulation::Release;
+
+    if (nextTimelineEvent < triggerRecord.phrase.attack.numPhonemes)
+        return Articulation::Attack;
+
+    return Articulation::Sustain;
+}
+
+bool Voice::usesPhraseTable(const PhraseTable* table) const
+{
+    return triggerRecord.phrase.table == table || (stealing && stealTrigger.phrase.table == table);
+}
+
 bool Voice::isReleasing() const
 {
     return envelope.getState() == Envelope::State::Release;
@@ -208,36 +237,149 @@ bool Voice::isReleasing() const
 
 bool Voice::isOver() const
 {
-    return envelope.getState() == Envelope::State::Off;
+    return !stealing && envelope.getState() == Envelope::State::Off;
 }
 
 void Voice::reset()
 {
+    // Voices may get recycled while still playing
+    envelope.reset();
     vibratoLevel = 0.0f;
+    stealTrigger = {};
+    stealFade = 0.0f;
+    stealFadeStep = 0.0f;
+    stealing = false;
+    releasePending = false;
+    outputDelay = 0;
+}
+
+//==============================================================================
+
+void VoiceKeyIndex::add(Voice* voice, int key)
+{
+    jassert(voice != nullptr);
+    jassert(voice->indexedKey < 0);
+
+    if (!isPositiveAndBelow(key, NUM_KEYS))
+        return;
+
+    auto& head{ heads[(size_t)key] };
+
+    voice->indexedKey = key;
+    voice->prevInKey = nullptr;
+    voice->nextInKey = head;
+
+    if (head != nullptr)
+        head->prevInKey = voice;
+
+    head = voice;
+}
+
+void VoiceKeyIndex::remove(Voice* voice)
+{
+    jassert(voice != nullptr);
+
+    if (voice->indexedKey < 0)
+        return;
+
+    if (voice->prevInKey != nullptr)
+        voice->prevInKey->nextInKey = voice->nextInKey;
+    else
+        heads[(size_t)voice->indexedKey] = voice->nextInKey;
+
+    if (voice->nextInKey != nullptr)
+        voice->nextInKey->prevInKey = voice->prevInKey;
+
+    voice->nextInKey = nullptr;
+    voice->prevInKey = nullptr;
+    voice->indexedKey = -1;
+}
+
+void VoiceKeyIndex::update(Voice* voice)
+{
+    jassert(voice != nullptr);
+
+    if (voice->indexedKey != voice->getKey()) {
+        remove(voice);
+        add(voice, voice->getKey());
+    }
+}
+
+//==============================================================================
+
+VoicePool::Bank::Bank(Engine& eng, size_t numVoices)
+    : voices(numVoices, eng)
+{
+    // Idle voices are taken from the back, so that
+    // the voices get triggered in memory order.
+    idleVoices.reserve(numVoices);
+
+    for (auto it{ voices.rbegin() }; it != voices.rend(); ++it)
+        idleVoices.push_back(&(*it));
 }
 
 //==============================================================================
 
 VoicePool::VoicePool(Engine& eng, size_t numVoices)
     : engine{ eng },
-      voices(numVoices, engine),
-      idleVoices{},
-      voiceCount{ 0 }
+      bank{ std::make_shared<Bank>(eng, numVoices) },
+      voiceCount{ 0 },
+      maxVoices{ numVoices }
+{
+    [[maybe_unused]] const bool reserved{ engine.getReclaimer().reserve() };
+    jassert(reserved);
+}
+
+void VoicePool::prepareToPlay()
+{
+    for (auto* b : { bank.get(), retiredBank.get(), pendingBank.get() }) {
+        if (b != nullptr) {
+            for (auto& voice : b->voices)
+                voice.prepareToPlay(Engine::INTERNAL_SAMPLE_RATE, (int)Engine::SUB_FRAME_LENGTH);
+        }
+    }
+}
+
+VoicePool::Bank::Ptr VoicePool::createBank(size_t numVoices) const
 {
-    for (auto& voice : voices)
-        idleVoices.append(&voice);
+    jassert(numVoices > 0 && numVoices <= maxVoicesLimit);
+
+    auto newBank{ std::make_shared<Bank>(engine, numVoices) };
+
+    // Banks may be created before the engine gets prepared
+    for (auto& voice : newBank->voices)
+        voice.prepareToPlay(Engine::INTERNAL_SAMPLE_RATE, (int)Engine::SUB_FRAME_LENGTH);
+
+    return newBank;
 }
 
-void VoicePool::prepareToPlay(float sampleRate, int samplesPerBlock)
+void VoicePool::setPendingBank(Bank::Ptr&& newBank)
 {
-    for (auto& voice : voices)
-        voice.prepareToPlay(sampleRate, samplesPerBlock);
+    engine.getReclaimer().retire(std::move(pendingBank));
+    pendingBank = std::move(newBank);
+}
+
+void VoicePool::update()
+{
+    // The previous bank must retire before another one can be adopted
+    if (retiredBank != nullptr || pendingBank == nullptr)
+        return;
+
+    if (bank->numActiveVoices > 0)
+        retiredBank = std::move(bank);
+    else
+        engine.getReclaimer().retire(std::move(bank));
+
+    bank = std::move(pendingBank);
+    maxVoices = bank->voices.size();
 }
 
 Voice* VoicePool::trigger(const Voice::Trigger& trigger)
 {
-    if (auto* voice{ idleVoices.first() }) {
-        idleVoices.remove(voice);
+    if (!bank->idleVoices.empty()) {
+        auto* voice{ bank->idleVoices.back() };
+        bank->idleVoices.pop_back();
+        ++bank->numActiveVoices;
         voice->trigger(trigger);
         ++voiceCount;
         return voice;
@@ -250,9 +392,19 @@ void VoicePool::recycle(Voice* voice)
 {
     jassert(voice != nullptr);
     voice->reset();
-    idleVoices.append(voice);
+
+    auto* owner{ bank->owns(voice) ? bank.get() : retiredBank.get() };
+    jassert(owner != nullptr && owner->owns(voice));
+
+    // Capacity is reserved for the entire bank, so this never allocates
+    owner->idleVoices.push_back(voice);
+    --owner->numActiveVoices;
     --voiceCount;
     jassert(voiceCount >= 0);
+
+    if (owner == retiredBank.get() && owner->numActiveVoices == 0) {
+        engine.getReclaimer().retire(std::move(retiredBank));
+    }
 }
 
 } // namespace engine
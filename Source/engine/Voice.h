@@ -1,25 +1,48 @@
 #pragma once
 
 #include <JuceHeader.h>
-#include "core/List.h"
+#include "core/CacheLine.h"
+#include "core/Queue.h"
 #include "model/VoiceProcessor.h"
 #include "engine/Envelope.h"
+#include "engine/PhonemeInventory.h"
 #include <vector>
 #include <atomic>
 
 namespace engine {
 
 class Engine;
+class VoiceKeyIndex;
+class PhraseTable;
 
-class Voice final : public core::ListItem<Voice>
+/**
+ * Voices may be rendered concurrently, so each one occupies
+ * its own cache lines to avoid false sharing.
+ */
+class alignas(core::CACHE_LINE_SIZE) Voice final
 {
 public:
 
-    /** A single phonene defined by its symbol and play duration. */
+    /** A single phonene defined by its inventory ID and play duration. */
     struct Phoneme
     {
-        char symbol{};
-        float duration{ 0.1f }; // [s]
+        PhonemeInventory::Id id{};
+        uint32 duration{};  // [samples]
+    };
+
+    /** Phonemes play for this long, as there is no way to specify the duration yet. */
+    constexpr static float DEFAULT_PHONEME_DURATION = 0.1f; // [s]
+    static uint32 getDefaultPhonemeDuration();
+
+    /**
+     * Part of a phrase, a view of the phonemes stored in a phrase table.
+     * Phoneme changes are replayed as a timeline measured from the beginning of the part.
+     */
+    struct Timeline
+    {
+        const Phoneme* phonemes{};
+        size_t numPhonemes{};
+        size_t length{};    // Total duration of the phonemes [samples]
     };
 
     /**
@@ -31,18 +54,14 @@ public:
      * while the note is sustained. On note release the release phrase will be vocalised.
      * The very last phoneme of the release phrase will trigger envelope release, and will be
      * released together with the envelope.
+     *
+     * The phonemes are owned by the phrase table, which must outlive the voice playing the phrase.
      */
     struct Phrase
     {
-        constexpr static size_t MAX_PHONEMES_PER_PHRASE = 8;
-
-        std::array<Phoneme, MAX_PHONEMES_PER_PHRASE> attack{};
-        size_t numAttackPhonemes{};
-
-        std::array<Phoneme, MAX_PHONEMES_PER_PHRASE> release{};
-        size_t numReleasePhonemes{};
-
-        void parse(const String& a, const String& r);
+        const PhraseTable* table{};
+        Timeline attack{};
+        Timeline release{};
     };
 
     /**
@@ -52,10 +71,31 @@ public:
     {
         int key{};
         float velocity{};
+        uint32 serial{};    // Trigger order, used to find the oldest voice
+        size_t delay{};     // Note start offset within a sub-frame [samples]
         Envelope::Spec envelope{};
         Phrase phrase{};
     };
 
+    /**
+     * Coarse articulation state of the voice.
+     * Active voices are kept grouped by this state, so that voices
+     * running the same code paths are rendered next to each other.
+     */
+    enum class Articulation
+    {
+        Attack,     // Vocalising the attack phonemes
+        Sustain,    // Holding the last attack phoneme
+        Release,    // Vocalising the release phonemes or releasing the envelope
+        Stealing    // Fading out before being retriggered
+    };
+
+    /** Longest output delay, must cover the engine sub-frame. */
+    constexpr static size_t MAX_OUTPUT_DELAY = 32;
+
+    /** Fade-out time of a voice being stolen. */
+    constexpr static float STEAL_FADE_TIME = 0.005f; // [s]
+
     Voice() = delete;
     Voice(Engine& eng);
 
@@ -63,8 +103,24 @@ public:
     void trigger(const Trigger& t);
     void retrigger(const Trigger& t);
     const Trigger& getTriggerRecord() const { return triggerRecord; }
+
+    /**
+     * Steal this voice for a new note.
+     * The voice gets quickly faded out and then triggered again with the new record.
+     */
+    void steal(const Trigger& t);
+    bool isStealing() const { return stealing; }
+
+    /** Tells whether the voice plays or is about to play a phrase from the table. */
+    bool usesPhraseTable(const PhraseTable* table) const;
+
+    /** Returns the key this voice is playing, or is about to play if being stolen. */
+    int getKey() const { return stealing ? stealTrigger.key : triggerRecord.key; }
+    float getLevel() const { return envelope.getLevel(); }
+    Articulation getArticulation() const;
+
     void release();
-    void process(float* outL, float* outR, size_t numFrames);
+    void process(float* out, size_t numFrames, float vibrato);
     bool isReleasing() const;
     bool isOver() const;
 
@@ -72,6 +128,14 @@ public:
 
 private:
 
+    friend class VoiceKeyIndex;
+
+    void renderFrames(float* out, size_t numFrames, float vibrato);
+    const Timeline& getTimeline() const { return attackPhase ? triggerRecord.phrase.attack : triggerRecord.phrase.release; }
+    const model::VoiceProcessor::ControlPoint& getControlPoint(const Phoneme& phoneme) const;
+    void startTimeline();
+    void advanceTimeline(size_t numFrames);
+
     Engine& engine;
     Trigger triggerRecord{};
     Envelope envelope{};
@@ -79,11 +143,56 @@ private:
     model::VoiceProcessor voiceProcessor{};
 
     bool attackPhase{};
-    size_t phonemeIndex{};
-    size_t generatedSamplesInPhoneme{};
-    size_t totalSamplesInPhoneme{};
+    size_t timelinePosition{};
+    size_t nextTimelineEvent{};
+    size_t nextTimelineEventTime{};
+    size_t nextTimelineMark{};  // Time of the next sustain or release step
 
     float vibratoLevel{};
+
+    Trigger stealTrigger{};
+    float stealFade{};
+    float stealFadeStep{};
+    bool stealing{};
+    bool releasePending{};
+
+    /*
+     * Voices are updated on a fixed sub-frame grid. A note starting in the middle
+     * of a sub-frame gets its output delayed, the tail is carried over to the next sub-frame.
+     */
+    size_t outputDelay{};
+    std::array<float, MAX_OUTPUT_DELAY> delayLine{};
+
+    /* Links of the per-key voice index */
+    Voice* nextInKey{};
+    Voice* prevInKey{};
+    int indexedKey{ -1 };
+};
+
+//==============================================================================
+
+/**
+ * Index of active voices by MIDI key.
+ *
+ * Voices of the same key are linked together, so that the voices
+ * playing a particular key can be found in constant time.
+ */
+class VoiceKeyIndex final
+{
+public:
+    constexpr static int NUM_KEYS = 128;
+
+    void add(Voice* voice, int key);
+    void remove(Voice* voice);
+
+    /** Re-index the voice if its key has changed. */
+    void update(Voice* voice);
+
+    Voice* first(int key) const { return isPositiveAndBelow(key, NUM_KEYS) ? heads[(size_t)key] : nullptr; }
+    static Voice* next(const Voice* voice) { return voice->nextInKey; }
+
+private:
+    std::array<Voice*, NUM_KEYS> heads{};
 };
 
 //==============================================================================
@@ -92,20 +201,66 @@ class VoicePool final
 {
 public:
     constexpr static size_t defaultMaxVoices = 32;
+    constexpr static size_t maxVoicesLimit = 1024;
+
+    /**
+     * A fixed set of voices.
+     * When the pool gets resized the whole bank is replaced.
+     */
+    struct Bank
+    {
+        using Ptr = std::shared_ptr<Bank>;
+
+        Bank(Engine& eng, size_t numVoices);
+
+        bool owns(const Voice* voice) const { return voice >= voices.data() && voice < voices.data() + voices.size(); }
+
+        std::vector<Voice> voices;
+        std::vector<Voice*> idleVoices{};
+        size_t numActiveVoices{};
+
+        JUCE_DECLARE_NON_COPYABLE(Bank)
+    };
 
     VoicePool(Engine& eng, size_t numVoices = defaultMaxVoices);
 
-    void prepareToPlay(float sampleRate, int samplesPerBlock);
+    /** Voices always run at the internal sample rate, one sub-frame at a time. */
+    void prepareToPlay();
+
+    /**
+     * Allocate a bank of voices ready to play.
+     * This must be called outside of the audio thread.
+     */
+    Bank::Ptr createBank(size_t numVoices) const;
+
+    /**
+     * Hand a new bank over to the audio thread, it gets adopted on the next
+     * update() call. A bank still waiting to be adopted is retired to the
+     * engine reclaimer.
+     */
+    void setPendingBank(Bank::Ptr&& newBank);
+
+    /**
+     * Switch to the pending bank of voices, if any.
+     * Voices of the previous bank keep playing until they are over.
+     */
+    void update();
+
     Voice* trigger(const Voice::Trigger& triger);
     void recycle(Voice* voice);
 
     int getVoiceCount() const { return voiceCount.load(); }
+    size_t getMaxVoices() const { return maxVoices.load(); }
 
 private:
     Engine& engine;
-    std::vector<Voice> voices;
-    core::List<Voice> idleVoices;
+
+    Bank::Ptr bank;
+    Bank::Ptr retiredBank{};
+    Bank::Ptr pendingBank{};
+
     std::atomic<int> voiceCount;
+    std::atomic<size_t> maxVoices;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VoicePool)
 };
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <type_traits>
+#include "core/CacheLine.h"
+
+namespace engine {
+
+/**
+ * @brief Pool of pre-spawned worker threads for the real-time processing.
+ *
+ * The thread calling run() takes part in processing as worker 0.
+ * Jobs are split into contiguous partitions, one per worker. Once a worker
+ * is done with its own partition it steals the remaining jobs from the others.
+ * Job distribution is lock-free, and the pool does not allocate while running.
+ *
+ * run() returns as soon as every job has completed: it only waits for
+ * the workers that actually claimed a job, not for every worker to wake up.
+ * Workers run with real-time priority and flush denormals.
+ *
+ * The workers are JUCE threads, so that they get the real-time scheduling
+ * of the platform. This is why the pool lives with the engine rather than
+ * with the JUCE-free primitives in core.
+ *
+ * @note Threads are created and destroyed in resize(), which must not
+ *       be called from the real-time thread.
+ */
+class WorkerPool final
+{
+public:
+
+    WorkerPool() = default;
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator =(const WorkerPool&) = delete;
+
+    ~WorkerPool()
+    {
+        resize(0);
+    }
+
+    /**
+     * Change the number of worker threads (excluding the calling thread).
+     */
+    void resize(size_t numThreads)
+    {
+        if (numThreads == threads.size())
+            return;
+
+        if (!threads.empty()) {
+            running.store(false, std::memory_order_relaxed);
+
+            for (auto& thread : threads)
+                thread->signalThreadShouldExit();
+
+            generation.fetch_add(1, std::memory_order_release);
+            generation.notify_all();
+
+            for (auto& thread : threads)
+                thread->waitForThreadToExit(-1);
+
+            threads.clear();
+        }
+
+        partitions.reset(new Partition[numThreads + 1]);
+        numPartitions = numThreads + 1;
+
+        running.store(true, std::memory_order_relaxed);
+
+        // Threads must start from the current generation, otherwise a late
+        // starting thread could miss the first run() call.
+        const unsigned startGeneration{ generation.load(std::memory_order_relaxed) };
+
+        for (size_t i = 0; i < numThreads; ++i) {
+            auto& thread{ threads.emplace_back(std::make_unique<Worker>(*this, i + 1, startGeneration)) };
+
+            if (!thread->startRealtimeThread(juce::Thread::RealtimeOptions{}.withPriority(realtimePriority)))
+                thread->startThread(juce::Thread::Priority::highest);
+        }
+    }
+
+    size_t getNumThreads() const noexcept { return threads.size(); }
+
+    /** Total number of workers, including the calling thread. */
+    size_t getNumWorkers() const noexcept { return threads.size() + 1; }
+
+    /**
+     * Execute func(jobIndex, workerIndex) for every job index in [0, numJobs)
+     * and wait for all the jobs to complete.
+     */
+    template <typename Func>
+    void run(size_t numJobs, Func&& func) noexcept
+    {
+        if (threads.empty() || numJobs <= 1) {
+            for (size_t i = 0; i < numJobs; ++i)
+                func(i, 0);
+
+            return;
+        }
+
+        jassert(numJobs <= maxJobs);
+
+        jobContext = &func;
+        jobFunction = [](void* ctx, size_t job, size_t worker) {
+            (*static_cast<std::remove_reference_t<Func>*>(ctx))(job, worker);
+        };
+
+        remainingJobs.store(numJobs, std::memory_order_relaxed);
+
+        // Tag the partitions with the new generation: a worker still busy with
+        // the previous run cannot claim these jobs, and a worker claiming one
+        // synchronizes with the job function written above.
+        const unsigned runGeneration{ generation.load(std::memory_order_relaxed) + 1 };
+        const size_t jobsPerWorker{ numJobs / numPartitions };
+        const size_t jobsRemainder{ numJobs % numPartitions };
+        size_t begin{};
+
+        for (size_t i = 0; i < numPartitions; ++i) {
+            const size_t end{ begin + jobsPerWorker + (i < jobsRemainder ? 1 : 0) };
+            partitions[i].state.store(packState(runGeneration, begin, end), std::memory_order_release);
+            begin = end;
+        }
+
+        // Wake up the workers
+        generation.store(runGeneration, std::memory_order_release);
+        generation.notify_all();
+
+        const size_t executed{ work(0, runGeneration) };
+
+        // Wait for the jobs claimed by the workers to finish
+        size_t remaining{ remainingJobs.fetch_sub(executed, std::memory_order_acq_rel) - executed };
+
+        for (int spin = 0; spin < maxSpins && remaining != 0; ++spin) {
+            std::this_thread::yield();
+            remaining = remainingJobs.load(std::memory_order_acquire);
+        }
+
+        while (remaining != 0) {
+            remainingJobs.wait(remaining, std::memory_order_acquire);
+            remaining = remainingJobs.load(std::memory_order_acquire);
+        }
+    }
+
+private:
+
+    class Worker final : public juce::Thread
+    {
+    public:
+
+        Worker(WorkerPool& p, size_t index, unsigned generation)
+            : juce::Thread{ "Voice worker " + juce::String{ (int)index } },
+              pool{ p },
+              workerIndex{ index },
+              startGeneration{ generation }
+        {
+        }
+
+        void run() override
+        {
+            pool.threadLoop(workerIndex, startGeneration);
+        }
+
+    private:
+
+        WorkerPool& pool;
+        const size_t workerIndex;
+        const unsigned startGeneration;
+    };
+
+    /* Generation (32 bits), next job (16 bits) and end job (16 bits) of a partition */
+    struct alignas(core::CACHE_LINE_SIZE) Partition
+    {
+        std::atomic<uint64_t> state{};
+    };
+
+    constexpr static int maxSpins = 256;
+    constexpr static int realtimePriority = 10;
+    constexpr static size_t maxJobs = 0xffff;
+
+    static uint64_t packState(unsigned gen, size_t next, size_t end) noexcept
+    {
+        return ((uint64_t)gen << 32) | ((uint64_t)next << 16) | (uint64_t)end;
+    }
+
+    void threadLoop(size_t workerIndex, unsigned seen)
+    {
+        const juce::ScopedNoDenormals noDenormals{};
+
+        for (;;) {
+            unsigned current{ generation.load(std::memory_order_acquire) };
+
+            for (int spin = 0; spin < maxSpins && current == seen; ++spin) {
+                std::this_thread::yield();
+                current = generation.load(std::memory_order_acquire);
+            }
+
+            while (current == seen) {
+                generation.wait(seen, std::memory_order_acquire);
+                current = generation.load(std::memory_order_acquire);
+            }
+
+            seen = current;
+
+            if (!running.load(std::memory_order_relaxed))
+                break;
+
+            const size_t executed{ work(workerIndex, current) };
+
+            if (executed != 0 && remainingJobs.fetch_sub(executed, std::memory_order_acq_rel) == executed)
+                remainingJobs.notify_one();
+        }
+    }
+
+    /** Process jobs of the given run, returns the number of jobs executed. */
+    size_t work(size_t workerIndex, unsigned runGeneration) noexcept
+    {
+        size_t executed{};
+
+        // Own partition first, then steal from the others
+        for (size_t k = 0; k < numPartitions; ++k) {
+            auto& partition{ partitions[(workerIndex + k) % numPartitions] };
+            uint64_t state{ partition.state.load(std::memory_order_acquire) };
+
+            for (;;) {
+                const size_t next{ (size_t)(state >> 16) & maxJobs };
+                const size_t end{ (size_t)state & maxJobs };
+
+                if ((unsigned)(state >> 32) != runGeneration || next >= end)
+                    break;
+
+                if (partition.state.compare_exchange_weak(state, state + (uint64_t{ 1 } << 16),
+                                                          std::memory_order_acquire,
+                                                          std::memory_order_acquire)) {
+                    jobFunction(jobContext, next, workerIndex);
+                    ++executed;
+                    state = partition.state.load(std::memory_order_acquire);
+                }
+            }
+        }
+
+        return executed;
+    }
+
+    std::vector<std::unique_ptr<Worker>> threads{};
+    std::unique_ptr<Partition[]> partitions{ new Partition[1] };
+    size_t numPartitions{ 1 };
+
+    void* jobContext{};
+    void (*jobFunction)(void*, size_t, size_t){};
+
+    alignas(core::CACHE_LINE_SIZE) std::atomic<unsigned> generation{};
+    alignas(core::CACHE_LINE_SIZE) std::atomic<size_t> remainingJobs{};
+    std::atomic<bool> running{ true };
+};
+
+} // namespace engine
@@ -4,24 +4,27 @@ namespace model {
 
 Glottis::Glottis()
 {
-    reset();
+    reset(makeWaveform(targetTenseness));
 }
 
-void Glottis::reset()
+void Glottis::reset(const Waveform& start)
 {
     timeInWaveform = 0.0f;
+    frequency = targetFrequency;
     oldFrequency = targetFrequency;
     newFrequency = targetFrequency;
     smoothFrequency = targetFrequency;
+    waveformLength = 1.0f / frequency;
+
     oldTenseness = targetTenseness;
     newTenseness = targetTenseness;
+    waveform = start;
+
     totalTime = 0.0f;
     intensity = 0.0f;
 
     isTouched = false;
     vibratoAmount = 0.0f;
-
-    initWaveform();
 }
 
 void Glottis::prepareToPlay(float sampleRate, float timePerBlock)
@@ -93,11 +96,12 @@ void Glottis::setFrequency(float f, bool force)
 
     if (force)
     {
+        // The waveform shape does not depend on the frequency, only its length does
+        frequency = f;
         smoothFrequency = f;
         oldFrequency = f;
         newFrequency = f;
-
-        initWaveform ();
+        waveformLength = 1.0f / f;
     }
 }
 
@@ -110,41 +114,52 @@ void Glottis::initWaveform(float lambda)
 {
     frequency = oldFrequency * (1.0f - lambda) + newFrequency * lambda;
     float tenseness = oldTenseness * (1.0f - lambda) + newTenseness * lambda;
-    float Rd = jlimit(0.5f, 2.7f, 3.0f * (1.0f - tenseness));
 
     waveformLength = 1.0f / frequency;
+    waveform = makeWaveform(tenseness);
+}
+
+Glottis::Waveform Glottis::makeWaveform(float tenseness)
+{
+    float Rd = jlimit(0.5f, 2.7f, 3.0f * (1.0f - tenseness));
 
     float Ra = -0.01f + 0.048f * Rd;
     float Rk = 0.224f + 0.118f * Rd;
     float Rg = (Rk / 4.0f) * (0.5f + 1.2f * Rk) / (0.11f * Rd - Ra * (0.5f + 1.2f * Rk));
 
+    Waveform w{};
+
     float Ta = Ra;
     float Tp = 1.0f / (2.0f * Rg);
-    Te = Tp + Tp * Rk;
+    w.Te = Tp + Tp * Rk;
 
-    epsilon = 1.0f / Ta;
-    shift = exp(-epsilon * (1.0f - Te));
-    delta = 1.0f - shift;
+    w.epsilon = 1.0f / Ta;
+    w.shift = exp(-w.epsilon * (1.0f - w.Te));
+    w.delta = 1.0f - w.shift;
 
-    float RHSIntegral = (1.0f / epsilon) * (shift - 1.0f) + (1.0f - Te) * shift;
-    RHSIntegral = RHSIntegral / delta;
+    float RHSIntegral = (1.0f / w.epsilon) * (w.shift - 1.0f) + (1.0f - w.Te) * w.shift;
+    RHSIntegral = RHSIntegral / w.delta;
 
-    float totalLowerIntegral = - (Te - Tp) / 2.0f + RHSIntegral;
+    float totalLowerIntegral = - (w.Te - Tp) / 2.0f + RHSIntegral;
     float totalUpperIntegral = -totalLowerIntegral;
 
-    omega = MathConstants<float>::pi / Tp;
-    float s = sin(omega * Te);
+    w.omega = MathConstants<float>::pi / Tp;
+    float s = sin(w.omega * w.Te);
 
     float y = -MathConstants<float>::pi * s * totalUpperIntegral / (Tp * 2.0f);
     float z = log(y);
-    alpha = z / (Tp / 2.0f - Te);
-    E0 = -1.0f / (s * exp(alpha*Te));
+    w.alpha = z / (Tp / 2.0f - w.Te);
+    w.E0 = -1.0f / (s * exp(w.alpha * w.Te));
+
+    return w;
 }
 
 float Glottis::normalizedLFWaveform(float t)
 {
-    float output = (t > Te) ? (-exp(-epsilon * (t - Te)) + shift) / delta
-                            : E0 * exp(alpha * t) * sin(omega * t);
+    const auto& w{ waveform };
+
+    float output = (t > w.Te) ? (-exp(-w.epsilon * (t - w.Te)) + w.shift) / w.delta
+                              : w.E0 * exp(w.alpha * t) * sin(w.omega * t);
 
     return output * intensity * loudness;
 }
@@ -9,9 +9,29 @@ namespace model {
 class Glottis
 {
 public:
+    /* Liljencrants-Fant waveform shape, it only depends on the tenseness */
+    struct Waveform
+    {
+        float alpha{};
+        float E0{};
+        float epsilon{};
+        float shift{};
+        float delta{};
+        float Te{};
+        float omega{};
+    };
+
+    static Waveform makeWaveform(float tenseness);
+
     Glottis();
 
-    void reset();
+    /**
+     * Start over from the current target frequency and tenseness.
+     * The start waveform must be the shape for the target tenseness, it
+     * is precomputed by the caller so that this only copies state and is
+     * cheap enough to be called on each note start.
+     */
+    void reset(const Waveform& start);
     void prepareToPlay(float sampleRate, float timePerBlock);
     float tick(float lambda, float noise);
 	float getNoiseModulator() const;
@@ -24,6 +44,7 @@ public:
     void setVibrato(float v) { vibratoAmount = jlimit(0.0f, 1.0f, v); }
 
 private:
+
     void initWaveform(float lambda = 0.0f);
     float normalizedLFWaveform(float t);
 
@@ -48,13 +69,7 @@ private:
     float newTenseness{ defaultTenseness };
     float targetTenseness{ defaultTenseness };
 
-	float alpha{};
-	float E0{};
-	float epsilon{};
-	float shift{};
-	float delta{};
-	float Te{};
-	float omega{};
+    Waveform waveform{};
 
 	float totalTime{};
 	float intensity{};
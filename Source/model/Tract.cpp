@@ -50,10 +50,27 @@ Tract::Tract()
 void Tract::reset(const Config& cfg)
 {
     config = cfg;
+    initializeState();
     reset();
 }
 
 void Tract::reset()
+{
+    jassert(!initialState.empty());
+
+    const float* src{ initialState.data() };
+
+    visitState([&src](float* data, size_t size) {
+        std::copy(src, src + size, data);
+        src += size;
+    });
+
+    // The velum opening follows its current target, it is not part of the initial state
+    noseDiameter[0] = velumTarget;
+    config.noseDiameter[0] = velumTarget;
+}
+
+void Tract::initializeState()
 {
     jassert(config.n > 0);
 
@@ -104,6 +121,26 @@ void Tract::reset()
     std::fill(noseMaxAmplitude.begin(), noseMaxAmplitude.end(), 0.0f);
 
     initialize();
+
+    initialState.clear();
+    visitState([this](float* data, size_t size) { initialState.insert(initialState.end(), data, data + size); });
+}
+
+template <typename Visitor>
+void Tract::visitState(Visitor&& visit)
+{
+    for (auto* array : { &diameter, &restDiameter, &targetDiameter, &newDiameter,
+                         &L, &R, &reflection, &newReflection, &junctionOutputL, &junctionOutputR, &A, &maxAmplitude,
+                         &noseL, &noseR, &noseJunctionOutputL, &noseJunctionOutputR,
+                         &noseReflection, &noseDiameter, &noseA, &noseMaxAmplitude,
+                         &config.tractDiameter, &config.noseDiameter }) {
+        visit(array->data(), array->size());
+    }
+
+    for (auto* value : { &reflectionLeft, &reflectionRight, &reflectionNose,
+                         &newReflectionLeft, &newReflectionRight, &newReflectionNose, &constrictionIndex }) {
+        visit(value, (size_t)1);
+    }
 }
 
 void Tract::prepareToPlay(float sr, float bt)
@@ -115,6 +152,8 @@ void Tract::prepareToPlay(float sr, float bt)
     sampleRate_r = 1.0f / sampleRate;
     blockTime = bt;
     transientCount = 0;
+
+    initializeState();
 }
 
 void Tract::tick(float glottalOutput, float turbulenceNoise, float lambda, Glottis& glottis)
@@ -145,7 +184,7 @@ void Tract::tick(float glottalOutput, float turbulenceNoise, float lambda, Glott
         noseJunctionOutputR[0] = r * noseL[0] + (1.0f + r) * (L[i] + R[i - 1]);
     }
 
-    const bool updateAmplitudes{ juce::Random::getSystemRandom().nextFloat() < 0.1f };
+    const bool updateAmplitudes{ random.nextFloat() < 0.1f };
 
     for (int i = 0; i < config.n; ++i) {
         R[i] = junctionOutputR[i] * 0.999f;
@@ -42,8 +42,16 @@ public:
 
     Tract();
 
+    /**
+     * Restore the initial state of the tract.
+     * The state only depends on the configuration, it is computed by prepareToPlay()
+     * and restored here with a plain copy, so that this can be called on each note start.
+     */
     void reset();
+
+    /** Change the configuration. This allocates, and must be called outside of the audio thread. */
     void reset(const Config& cfg);
+
     void prepareToPlay(float sampleRate, float blockTime);
     void tick(float glottalOutput, float turbulenceNoise, float lambda, Glottis& glottis);
     void finishBlock();
@@ -60,6 +68,7 @@ public:
 
 private:
 
+    void initializeState();
     void initialize();
     void calculateReflections();
     void calculateNoseReflections();
@@ -69,6 +78,10 @@ private:
     void reshapeTract(float deltaTime);
     void processTransients();
 
+    /* Visit the state captured by initializeState(), in a fixed order */
+    template <typename Visitor>
+    void visitState(Visitor&& visit);
+
     Config config{};
     float sampleRate{ 44100.0f };
     float sampleRate_r { 1.0f / sampleRate };
@@ -117,6 +130,12 @@ private:
 
     float lipOutput{};
     float noseOutput{};
+
+    /* Initial state of the waveguide, stored contiguously in the visitState() order */
+    std::vector<float> initialState{};
+
+    // Each tract owns its random generator, so that voices can be rendered concurrently
+    juce::Random random{};
 };
 
 } // namespace model
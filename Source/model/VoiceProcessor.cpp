@@ -28,12 +28,12 @@ void VoiceProcessor::setControlPoint(const VoiceProcessor::ControlPoint& cp)
     targetControlPoint = cp;
 }
 
-void VoiceProcessor::trigger(const VoiceProcessor::ControlPoint& cp)
+void VoiceProcessor::trigger(const VoiceProcessor::ControlPoint& cp, const Glottis::Waveform& startWaveform)
 {
     setControlPoint(cp);
     updateControlPoint();
 
-    glottis.reset();
+    glottis.reset(startWaveform);
     tract.reset();
 
     fricativeIntensity = 0.0f;
@@ -58,7 +58,7 @@ void VoiceProcessor::release()
     glottis.setTouched(false);
 }
 
-void VoiceProcessor::process(float* out, int numFrames)
+void VoiceProcessor::process(float* out, const float* gain, int numFrames)
 {
     const float Nr{ 1.0f / float(numFrames) };
 
@@ -79,7 +79,7 @@ void VoiceProcessor::process(float* out, int numFrames)
         vocalOutput += tract.getLipOutput() + tract.getNoseOutput();
         vocalOutput *= 0.125f;
 
-        out[i] = vocalOutput;
+        out[i] += vocalOutput * gain[i];
     }
 
     update();
@@ -24,10 +24,21 @@ public:
 
     void prepareToPlay(float sampleRate, int samplesPerBlock);
     void setControlPoint(const ControlPoint& cp);
-    void trigger(const VoiceProcessor::ControlPoint& cp);
+
+    /**
+     * Start a note from the given control point.
+     * The start waveform is the glottal shape for the control point's
+     * tenseness, see Glottis::makeWaveform().
+     */
+    void trigger(const VoiceProcessor::ControlPoint& cp, const Glottis::Waveform& startWaveform);
     void retrigger(const VoiceProcessor::ControlPoint& cp);
     void release();
-    void process(float* out, int numFrames);
+
+    /**
+     * Render numFrames samples scaled by the per-sample gain
+     * and accumulate them into the output buffer.
+     */
+    void process(float* out, const float* gain, int numFrames);
 
     void setFrequency(float f, bool force = false);
     void setVibrato(float level);
@@ -0,0 +1,196 @@
+/**
+ * Throughput benchmark of the lock-free primitives in Source/core.
+ *
+ * Each case reports the average cost per element. The "same thread" cases
+ * measure the bare cost of the operations, the threaded ones include the
+ * cache traffic between the producer and consumer cores.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "core/Queue.h"
+#include "core/MPSCQueue.h"
+#include "core/Reclaimer.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t numMessages = 4000000;
+constexpr size_t queueSize = 1024;
+constexpr size_t batchSize = 16;
+
+void report(const char* name, Clock::time_point start, size_t numElements)
+{
+    const std::chrono::duration<double, std::nano> elapsed{ Clock::now() - start };
+    std::printf("%-40s %8.2f ns/element\n", name, elapsed.count() / (double)numElements);
+}
+
+void benchQueueSameThread()
+{
+    auto queue{ std::make_unique<core::Queue<size_t, queueSize>>() };
+    size_t value{};
+    size_t sum{};
+
+    auto start{ Clock::now() };
+
+    for (size_t i = 0; i < numMessages; ++i) {
+        queue->send(i);
+        queue->receive(value);
+        sum += value;
+    }
+
+    report("SPSC send/receive, same thread", start, numMessages);
+
+    size_t in[batchSize]{};
+    size_t out[batchSize]{};
+
+    start = Clock::now();
+
+    for (size_t i = 0; i < numMessages; i += batchSize) {
+        in[0] = i;
+        queue->sendBatch(in, batchSize);
+        queue->receiveBatch(out, batchSize);
+        sum += out[0];
+    }
+
+    report("SPSC batch of 16, same thread", start, numMessages);
+
+    if (sum == 0)
+        std::printf("\n");
+}
+
+void benchQueueThreads(bool batched)
+{
+    auto queue{ std::make_unique<core::Queue<size_t, queueSize>>() };
+
+    auto start{ Clock::now() };
+
+    std::thread consumer{ [&] {
+        size_t received{};
+        size_t out[batchSize]{};
+
+        while (received < numMessages) {
+            const size_t n{ batched ? queue->receiveBatch(out, batchSize)
+                                    : (queue->receive(out[0]) ? 1u : 0u) };
+            received += n;
+
+            if (n == 0)
+                std::this_thread::yield();
+        }
+    } };
+
+    size_t sent{};
+    size_t in[batchSize]{};
+
+    while (sent < numMessages) {
+        const size_t n{ batched ? queue->sendBatch(in, batchSize)
+                                : (queue->send(sent) ? 1u : 0u) };
+        sent += n;
+
+        if (n == 0)
+            std::this_thread::yield();
+    }
+
+    consumer.join();
+
+    report(batched ? "SPSC batch of 16, two threads" : "SPSC send/receive, two threads", start, numMessages);
+}
+
+void benchMPSCQueue(size_t numProducers)
+{
+    auto queue{ std::make_unique<core::MPSCQueue<size_t, queueSize>>() };
+    const size_t perProducer{ numMessages / numProducers };
+    std::vector<std::thread> producers{};
+
+    auto start{ Clock::now() };
+
+    for (size_t p = 0; p < numProducers; ++p) {
+        producers.emplace_back([&] {
+            for (size_t i = 0; i < perProducer; ++i) {
+                while (!queue->send(i))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    size_t received{};
+    size_t out[batchSize]{};
+
+    while (received < perProducer * numProducers) {
+        const size_t n{ queue->receiveBatch(out, batchSize) };
+        received += n;
+
+        if (n == 0)
+            std::this_thread::yield();
+    }
+
+    for (auto& producer : producers)
+        producer.join();
+
+    char name[64]{};
+    std::snprintf(name, sizeof(name), "MPSC send/receive, %zu producer(s)", numProducers);
+    report(name, start, received);
+}
+
+void benchReclaimer()
+{
+    constexpr size_t capacity{ 256 };
+    constexpr size_t numObjects{ numMessages / 4 };
+
+    core::Reclaimer<capacity> reclaimer{};
+    std::vector<std::shared_ptr<int>> objects(capacity);
+
+    for (auto& obj : objects)
+        obj = std::make_shared<int>(0);
+
+    // Retire and collect whole rounds of objects, the way the engine does
+    // between two housekeeping ticks. Objects are created outside of the
+    // timed section and only their last reference gets dropped by collect().
+    Clock::duration retireTime{};
+    Clock::duration collectTime{};
+
+    for (size_t done = 0; done < numObjects; done += capacity) {
+        for (auto& obj : objects) {
+            reclaimer.reserve();
+            obj = std::make_shared<int>(0);
+        }
+
+        auto start{ Clock::now() };
+
+        for (auto& obj : objects)
+            reclaimer.retire(std::move(obj));
+
+        auto middle{ Clock::now() };
+        reclaimer.collect();
+
+        retireTime += middle - start;
+        collectTime += Clock::now() - middle;
+    }
+
+    const std::chrono::duration<double, std::nano> retire{ retireTime };
+    const std::chrono::duration<double, std::nano> collect{ collectTime };
+
+    std::printf("%-40s %8.2f ns/element\n", "Reclaimer retire (real-time side)", retire.count() / (double)numObjects);
+    std::printf("%-40s %8.2f ns/element\n", "Reclaimer collect (includes delete)", collect.count() / (double)numObjects);
+}
+
+} // namespace
+
+int main()
+{
+    benchQueueSameThread();
+    benchQueueThreads(false);
+    benchQueueThreads(true);
+
+    for (size_t numProducers : { 1, 2, 4 })
+        benchMPSCQueue(numProducers);
+
+    benchReclaimer();
+
+    return 0;
+}
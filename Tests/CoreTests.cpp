@@ -0,0 +1,272 @@
+/**
+ * Stress tests of the lock-free primitives in Source/core.
+ *
+ * These do not depend on JUCE. Each test hammers a primitive from
+ * several threads and checks that nothing gets lost, duplicated
+ * or reordered. Run it under ThreadSanitizer to catch data races.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "core/Queue.h"
+#include "core/MPSCQueue.h"
+#include "core/Reclaimer.h"
+
+namespace {
+
+int failures{ 0 };
+
+void expect(bool condition, const char* what)
+{
+    if (!condition) {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+constexpr size_t numMessages = 200000;
+
+void testQueueCapacity()
+{
+    core::Queue<int, 8> queue{};
+    int value{};
+
+    for (int i = 0; i < 7; ++i)
+        expect(queue.send(i), "Queue accepts Size - 1 elements");
+
+    expect(!queue.send(7), "Queue rejects elements when full");
+    expect(queue.count() == 7, "Queue counts its elements");
+
+    for (int i = 0; i < 7; ++i)
+        expect(queue.receive(value) && value == i, "Queue preserves order");
+
+    expect(!queue.receive(value), "Queue is empty after draining");
+}
+
+void testQueueBatchWrap()
+{
+    core::Queue<int, 8> queue{};
+    int in[8]{ 0, 1, 2, 3, 4, 5, 6, 7 };
+    int out[8]{};
+
+    // Move the indices so that batches wrap around the end of the ring
+    for (int round = 0; round < 20; ++round) {
+        const size_t sent{ queue.sendBatch(in, 5) };
+        expect(sent == 5, "sendBatch sends everything that fits");
+
+        const size_t received{ queue.receiveBatch(out, 8) };
+        expect(received == 5, "receiveBatch receives everything available");
+
+        for (size_t i = 0; i < received; ++i)
+            expect(out[i] == in[i], "Batches preserve order across the wrap");
+    }
+
+    expect(queue.sendBatch(in, 8) == 7, "sendBatch stops when the queue is full");
+    expect(queue.receiveBatch(out, 3) == 3, "receiveBatch honours maxObjs");
+    expect(queue.receiveBatch(out, 8) == 4, "receiveBatch returns the remaining elements");
+}
+
+void testQueueStress()
+{
+    auto queue{ std::make_unique<core::Queue<size_t, 64>>() };
+    std::atomic<bool> ordered{ true };
+
+    std::thread consumer{ [&] {
+        size_t expected{};
+        size_t batch[16]{};
+
+        while (expected < numMessages) {
+            const size_t previous{ expected };
+
+            // Alternate single and batch receives
+            if (expected % 3 == 0) {
+                size_t value{};
+
+                if (queue->receive(value)) {
+                    ordered = ordered && value == expected;
+                    ++expected;
+                }
+            } else {
+                const size_t n{ queue->receiveBatch(batch, 16) };
+
+                for (size_t i = 0; i < n; ++i) {
+                    ordered = ordered && batch[i] == expected;
+                    ++expected;
+                }
+            }
+
+            if (expected == previous)
+                std::this_thread::yield();
+        }
+    } };
+
+    size_t next{};
+    size_t batch[16]{};
+
+    while (next < numMessages) {
+        size_t sent{};
+
+        if (next % 2 == 0) {
+            sent = queue->send(next) ? 1 : 0;
+        } else {
+            const size_t n{ std::min<size_t>(16, numMessages - next) };
+
+            for (size_t i = 0; i < n; ++i)
+                batch[i] = next + i;
+
+            sent = queue->sendBatch(batch, n);
+        }
+
+        next += sent;
+
+        if (sent == 0)
+            std::this_thread::yield();
+    }
+
+    consumer.join();
+
+    expect(ordered, "SPSC queue delivers every element once and in order");
+}
+
+void testMPSCQueueStress()
+{
+    constexpr size_t numProducers{ 4 };
+    constexpr size_t perProducer{ numMessages / numProducers };
+
+    struct Message
+    {
+        size_t producer{};
+        size_t seq{};
+    };
+
+    auto queue{ std::make_unique<core::MPSCQueue<Message, 64>>() };
+    std::vector<std::thread> producers{};
+
+    for (size_t p = 0; p < numProducers; ++p) {
+        producers.emplace_back([&queue, p] {
+            for (size_t i = 0; i < perProducer; ++i) {
+                while (!queue->send(Message{ p, i }))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    std::vector<size_t> nextSeq(numProducers, 0);
+    bool ordered{ true };
+    size_t received{};
+    Message batch[8]{};
+
+    while (received < numProducers * perProducer) {
+        const size_t n{ queue->receiveBatch(batch, 8) };
+
+        for (size_t i = 0; i < n; ++i) {
+            ordered = ordered && batch[i].seq == nextSeq[batch[i].producer];
+            ++nextSeq[batch[i].producer];
+        }
+
+        received += n;
+
+        if (n == 0)
+            std::this_thread::yield();
+    }
+
+    for (auto& producer : producers)
+        producer.join();
+
+    Message extra{};
+    expect(ordered, "MPSC queue keeps each producer's elements in order");
+    expect(!queue->receive(extra), "MPSC queue delivers no extra elements");
+}
+
+struct Tracked
+{
+    explicit Tracked(std::atomic<int>& c) : counter{ c } { ++counter; }
+    ~Tracked() { --counter; }
+
+    std::atomic<int>& counter;
+};
+
+void testReclaimer()
+{
+    constexpr size_t capacity{ 16 };
+
+    core::Reclaimer<capacity> reclaimer{};
+    std::atomic<int> alive{ 0 };
+
+    for (size_t i = 0; i < capacity; ++i)
+        expect(reclaimer.reserve(), "Reclaimer reserves up to its capacity");
+
+    expect(!reclaimer.reserve(), "Reclaimer refuses to reserve past its capacity");
+
+    reclaimer.cancel();
+    expect(reclaimer.reserve(), "Cancelled reservations can be reused");
+
+    // Hand objects over to a "real-time" thread, which retires them while
+    // the main thread keeps collecting
+    core::Queue<std::shared_ptr<Tracked>, capacity + 1> handOver{};
+    std::atomic<bool> done{ false };
+
+    for (size_t i = 0; i < capacity; ++i)
+        reclaimer.cancel();
+
+    std::thread realtime{ [&] {
+        std::shared_ptr<Tracked> obj{};
+
+        while (!done || handOver.count() > 0) {
+            if (handOver.receive(obj))
+                reclaimer.retire(std::move(obj));
+            else
+                std::this_thread::yield();
+        }
+    } };
+
+    constexpr int numObjects{ 100000 };
+    int sent{};
+
+    while (sent < numObjects) {
+        if (reclaimer.reserve()) {
+            auto obj{ std::make_shared<Tracked>(alive) };
+
+            if (handOver.send(std::move(obj)))
+                ++sent;
+            else
+                reclaimer.cancel();
+        }
+
+        reclaimer.collect();
+        std::this_thread::yield();
+    }
+
+    done = true;
+    realtime.join();
+    reclaimer.collect();
+
+    expect(alive == 0, "Reclaimer destroys every retired object on collect");
+
+    for (size_t i = 0; i < capacity; ++i)
+        expect(reclaimer.reserve(), "Collecting gives the reservations back");
+}
+
+} // namespace
+
+int main()
+{
+    testQueueCapacity();
+    testQueueBatchWrap();
+    testQueueStress();
+    testMPSCQueueStress();
+    testReclaimer();
+
+    if (failures != 0) {
+        std::printf("%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("All core tests passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,267 @@
+/**
+ * Timing of the engine hot paths.
+ *
+ * Run this on a release build, the figures are only meaningful
+ * relative to each other on the same machine.
+ */
+
+#include <JuceHeader.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "engine/Engine.h"
+#include "engine/Lyrics.h"
+#include "engine/PhonemeInventory.h"
+#include "engine/Voice.h"
+#include "model/VoiceProcessor.h"
+
+namespace {
+
+using engine::VoiceKeyIndex;
+using Clock = std::chrono::steady_clock;
+
+constexpr int numRenderedSeconds = 5;
+
+double elapsedMicroseconds(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+const char* getRenderStrategyName(engine::Engine::RenderStrategy strategy)
+{
+    switch (strategy) {
+    case engine::Engine::RenderStrategy::VoiceMajor:    return "voice-major";
+    case engine::Engine::RenderStrategy::SubFrameMajor: return "sub-frame-major";
+    }
+
+    return "";
+}
+
+/**
+ * Render the same amount of audio with the given host block size. Voice-major
+ * rendering keeps each voice's model state in cache over the whole block, the
+ * sub-frame-major order walks all the voices on every sub-frame instead.
+ */
+double benchRender(float sampleRate, int blockSize, int numNotes, engine::Engine::RenderStrategy strategy)
+{
+    auto engine{ std::make_unique<engine::Engine>() };
+    engine->setMaxVoices((size_t)numNotes);
+    engine->setLegato(false);
+    engine->setRenderStrategy(strategy);
+    engine->setLyrics("la-ma do-re mi fa so la-ti");
+    engine->prepareToPlay(sampleRate, blockSize);
+
+    std::vector<float> left((size_t)blockSize);
+    std::vector<float> right((size_t)blockSize);
+
+    // Pick up the lyrics and the voice pool before the notes start
+    engine->process(left.data(), right.data(), 0);
+    engine->performHousekeeping();
+
+    for (int i = 0; i < numNotes; ++i)
+        engine->processMidiMessage(MidiMessage::noteOn(1, 36 + 2 * i, 0.8f));
+
+    engine->process(left.data(), right.data(), (size_t)blockSize);
+
+    const int numBlocks{ numRenderedSeconds * (int)sampleRate / blockSize };
+    const auto start{ Clock::now() };
+
+    for (int b = 0; b < numBlocks; ++b)
+        engine->process(left.data(), right.data(), (size_t)blockSize);
+
+    const double perBlock{ elapsedMicroseconds(start) / numBlocks };
+    const double perSample{ 1000.0 * perBlock / blockSize };
+
+    std::printf("render %2d voices @ %6.0f Hz, %4d samples, %-15s %9.2f us/block %7.2f ns/sample\n",
+                engine->getVoiceCount(), sampleRate, blockSize, getRenderStrategyName(strategy), perBlock, perSample);
+
+    return perSample;
+}
+
+/**
+ * Fill a large voice pool and time the note handling, which goes through
+ * the key index rather than scanning the active voices. Each key ends up
+ * with two voices.
+ */
+void benchKeyIndex()
+{
+    constexpr int numVoices{ 256 };
+    constexpr int numRounds{ 200 };
+    constexpr int blockSize{ 512 };
+
+    auto engine{ std::make_unique<engine::Engine>() };
+    engine->setMaxVoices((size_t)numVoices);
+    engine->setLegato(false);
+    engine->setLyrics("la-ma do-re mi fa so la-ti");
+    engine->prepareToPlay(48000.0f, blockSize);
+
+    std::vector<float> left((size_t)blockSize);
+    std::vector<float> right((size_t)blockSize);
+
+    engine->process(left.data(), right.data(), 0);
+    engine->performHousekeeping();
+
+    const auto allSoundOff{ MidiMessage::controllerEvent(1, 120, 0) };
+    const auto sustainOn{ MidiMessage::controllerEvent(1, 64, 127) };
+    const auto sustainOff{ MidiMessage::controllerEvent(1, 64, 0) };
+
+    double noteOnTime{};
+    double noteOffTime{};
+    double sustainedNoteOffTime{};
+    double sustainReleaseTime{};
+    int numActiveVoices{};
+
+    for (int r = 0; r < numRounds; ++r) {
+        const bool sustain{ r % 2 == 1 };
+
+        auto start{ Clock::now() };
+
+        for (int i = 0; i < numVoices; ++i)
+            engine->processMidiMessage(MidiMessage::noteOn(1, i % VoiceKeyIndex::NUM_KEYS, 0.8f));
+
+        noteOnTime += elapsedMicroseconds(start);
+        numActiveVoices = engine->getVoiceCount();
+
+        if (sustain)
+            engine->processMidiMessage(sustainOn);
+
+        start = Clock::now();
+
+        for (int key = 0; key < VoiceKeyIndex::NUM_KEYS; ++key)
+            engine->processMidiMessage(MidiMessage::noteOff(1, key));
+
+        (sustain ? sustainedNoteOffTime : noteOffTime) += elapsedMicroseconds(start);
+
+        if (sustain) {
+            start = Clock::now();
+            engine->processMidiMessage(sustainOff);
+            sustainReleaseTime += elapsedMicroseconds(start);
+        }
+
+        // Recycle all the voices for the next round
+        engine->processMidiMessage(allSoundOff);
+    }
+
+    constexpr double numNoteOffs{ (double)VoiceKeyIndex::NUM_KEYS * numRounds / 2 };
+
+    std::printf("%d voices: note-on                %8.3f us/note\n", numActiveVoices, noteOnTime / (numVoices * numRounds));
+    std::printf("%d voices: note-off               %8.3f us/key\n", numActiveVoices, noteOffTime / numNoteOffs);
+    std::printf("%d voices: note-off, sustained    %8.3f us/key\n", numActiveVoices, sustainedNoteOffTime / numNoteOffs);
+    std::printf("%d voices: sustain pedal release  %8.3f us\n", numActiveVoices, sustainReleaseTime / (numRounds / 2));
+}
+
+/**
+ * Time the voice model note start. Each voice starts on a different phoneme
+ * than its previous note, as it happens with chords, so the glottal waveform
+ * for the new tenseness must come from the inventory.
+ */
+void benchTrigger()
+{
+    constexpr int numVoices{ 16 };
+    constexpr int numTriggers{ 200000 };
+
+    const auto inventory{ engine::PhonemeInventory::createDefault() };
+    std::vector<model::VoiceProcessor> voices(numVoices);
+
+    for (auto& voice : voices)
+        voice.prepareToPlay(engine::Engine::INTERNAL_SAMPLE_RATE, (int)engine::Engine::SUB_FRAME_LENGTH);
+
+    std::vector<float> out(engine::Engine::SUB_FRAME_LENGTH);
+    std::vector<float> gain(engine::Engine::SUB_FRAME_LENGTH, 1.0f);
+
+    for (bool samePhoneme : { true, false }) {
+        double total{};
+
+        for (int i = 0; i < numTriggers; ++i) {
+            auto& voice{ voices[(size_t)i % numVoices] };
+            voice.setFrequency(100.0f + float(i % 300), true);
+
+            const auto id{ (engine::PhonemeInventory::Id)(samePhoneme ? 1 : 1 + i % ((int)inventory->size() - 1)) };
+
+            const auto start{ Clock::now() };
+            voice.trigger((*inventory)[id], inventory->getStartWaveform(id));
+            total += elapsedMicroseconds(start);
+
+            voice.process(out.data(), gain.data(), (int)engine::Engine::SUB_FRAME_LENGTH);
+        }
+
+        std::printf("voice trigger (%-14s)              %8.3f us\n", samePhoneme ? "same phoneme" : "mixed phonemes", total / numTriggers);
+    }
+}
+
+void benchLyrics()
+{
+    constexpr int numWords{ 100000 };
+    const char* words[]{ "la-ma", "Do-re", "mi", "fa,", "so-la-ti", "hello!", "caf\xc3\xa9", "-a", "b-" };
+
+    std::string text{};
+
+    for (int i = 0; i < numWords; ++i) {
+        text += words[i % 9];
+        text += i % 7 == 0 ? "\n" : " ";
+    }
+
+    engine::Lyrics lyrics{ engine::PhonemeInventory::createDefault() };
+    const auto start{ Clock::now() };
+    lyrics.parse(std::string_view{ text });
+
+    std::printf("lyrics parse, %d words, %zu phrases      %8.2f ms\n", numWords, lyrics.size(), elapsedMicroseconds(start) / 1000.0);
+}
+
+void benchVoicePoolResize()
+{
+    constexpr int blockSize{ 512 };
+
+    auto engine{ std::make_unique<engine::Engine>() };
+    engine->prepareToPlay(48000.0f, blockSize);
+
+    std::vector<float> left((size_t)blockSize);
+    std::vector<float> right((size_t)blockSize);
+
+    constexpr int numResizes{ 50 };
+    double resizeTime{};
+    double swapTime{};
+
+    for (int i = 0; i < numResizes; ++i) {
+        auto start{ Clock::now() };
+        engine->setMaxVoices(i % 2 == 0 ? 64 : 16);
+        resizeTime += elapsedMicroseconds(start);
+
+        // The new bank is swapped in by the next process() call
+        start = Clock::now();
+        engine->process(left.data(), right.data(), blockSize);
+        swapTime += elapsedMicroseconds(start);
+
+        engine->performHousekeeping();
+    }
+
+    std::printf("voice pool resize (message thread)           %8.2f us\n", resizeTime / numResizes);
+    std::printf("voice pool swap + idle block (audio thread)  %8.2f us\n", swapTime / numResizes);
+}
+
+} // namespace
+
+int main()
+{
+    constexpr int numVoices{ 32 };
+
+    for (float sampleRate : { 44100.0f, 48000.0f }) {
+        for (int blockSize : { 512, 1024 }) {
+            const double subFrameMajor{ benchRender(sampleRate, blockSize, numVoices, engine::Engine::RenderStrategy::SubFrameMajor) };
+            const double voiceMajor{ benchRender(sampleRate, blockSize, numVoices, engine::Engine::RenderStrategy::VoiceMajor) };
+
+            std::printf("voice-major speedup                                                 %6.2fx\n", subFrameMajor / voiceMajor);
+        }
+    }
+
+    benchKeyIndex();
+    benchTrigger();
+    benchLyrics();
+    benchVoicePoolResize();
+
+    return 0;
+}
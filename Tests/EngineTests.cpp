@@ -0,0 +1,349 @@
+/**
+ * Unit tests of the engine building blocks.
+ *
+ * The incremental lyrics update must give the same phrases as parsing
+ * and compiling the edited text from scratch, and the playback position
+ * must follow the edits. Phoneme symbols must be split and lower-cased
+ * the same way as the lyrics that refer to them. The worker pool must run
+ * every job exactly once, whatever the number of jobs and threads.
+ */
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/Engine.h"
+#include "engine/Lyrics.h"
+#include "engine/PhonemeInventory.h"
+#include "engine/PhraseTable.h"
+#include "engine/WorkerPool.h"
+
+namespace {
+
+using engine::Lyrics;
+using engine::PhraseTable;
+
+int failures{ 0 };
+
+void expect(bool condition, const char* what)
+{
+    if (!condition) {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+bool haveSamePhonemes(const engine::Voice::Timeline& a, const engine::Voice::Timeline& b)
+{
+    if (a.numPhonemes != b.numPhonemes || a.length != b.length)
+        return false;
+
+    for (size_t i = 0; i < a.numPhonemes; ++i) {
+        if (a.phonemes[i].id != b.phonemes[i].id || a.phonemes[i].duration != b.phonemes[i].duration)
+            return false;
+    }
+
+    return true;
+}
+
+bool haveSamePhrases(const PhraseTable& a, size_t indexA, const PhraseTable& b, size_t indexB)
+{
+    const auto phraseA{ a[indexA] };
+    const auto phraseB{ b[indexB] };
+
+    return haveSamePhonemes(phraseA.attack, phraseB.attack) && haveSamePhonemes(phraseA.release, phraseB.release);
+}
+
+/* Text edit, expressed the way the lyrics editor reports it */
+struct TextEdit
+{
+    const char* name;
+    const char* before;
+    const char* after;
+    int start;          // First edited character
+    int numRemoved;
+    int numInserted;
+};
+
+const TextEdit textEdits[]{
+    { "insert a word",              "la ma do re mi",  "la ma so do re mi",  6, 0, 3 },
+    { "insert into a word",         "la ma do re mi",  "la mao do re mi",    5, 0, 1 },
+    { "insert at the end",          "la ma do",        "la ma do re",        8, 0, 3 },
+    { "delete a word",              "la ma do re mi",  "la ma re mi",        6, 3, 0 },
+    { "delete from the start",      "la ma do re mi",  "ma do re mi",        0, 3, 0 },
+    { "delete everything",          "la ma",           "",                   0, 5, 0 },
+    { "join two phrases",           "la ma do re mi",  "la mado re mi",      5, 1, 0 },
+    { "split a phrase",             "la ma do re mi",  "la m a do re mi",    4, 0, 1 },
+    { "split attack and release",   "la ma do re mi",  "la m-a do re mi",    4, 0, 1 },
+    { "join attack and release",    "la m-a do re mi", "la ma do re mi",     4, 1, 0 },
+    { "replace across phrases",     "la ma do re mi",  "la mi fa re mi",     3, 5, 5 },
+    { "insert a line break",        "la ma do re mi",  "la ma\ndo re mi",    5, 1, 1 },
+};
+
+void testIncrementalLyrics()
+{
+    const auto inventory{ engine::PhonemeInventory::createDefault() };
+
+    for (const auto& textEdit : textEdits) {
+        std::printf("  %s\n", textEdit.name);
+
+        Lyrics previous{ inventory };
+        expect(previous.parse(std::string_view{ textEdit.before }).wasOk(), "Lyrics get parsed");
+
+        PhraseTable previousTable{ inventory };
+        previousTable.compile(previous);
+
+        Lyrics::Edit edit{};
+
+        if (textEdit.numRemoved > 0)
+            edit.remove(textEdit.start, textEdit.start + textEdit.numRemoved);
+
+        if (textEdit.numInserted > 0)
+            edit.insert(textEdit.start, textEdit.numInserted);
+
+        Lyrics incremental{ inventory };
+        Lyrics::Patch patch{};
+        expect(incremental.parse(previous, std::string_view{ textEdit.after }, edit, patch).wasOk(), "Edited lyrics get parsed");
+
+        Lyrics full{ inventory };
+        expect(full.parse(std::string_view{ textEdit.after }).wasOk(), "Edited lyrics get parsed from scratch");
+
+        expect(incremental.size() == full.size(), "Incremental parse gives the same number of phrases");
+
+        if (incremental.size() != full.size())
+            continue;
+
+        for (size_t i = 0; i < full.size(); ++i) {
+            expect(incremental[i].attack == full[i].attack, "Incremental parse gives the same attacks");
+            expect(incremental[i].release == full[i].release, "Incremental parse gives the same releases");
+            expect(incremental[i].position == full[i].position, "Incremental parse gives the same positions");
+        }
+
+        expect(patch.firstPhrase + patch.numRemoved <= previous.size(), "Patch stays within the previous phrases");
+        expect(previous.size() - patch.numRemoved + patch.numInserted == full.size(), "Patch accounts for all the phrases");
+
+        PhraseTable patchedTable{ inventory };
+        patchedTable.compile(previousTable, incremental, patch);
+
+        PhraseTable fullTable{ inventory };
+        fullTable.compile(full);
+
+        expect(patchedTable.size() == fullTable.size(), "Patched table has the same number of phrases");
+
+        for (size_t i = 0; i < fullTable.size() && i < patchedTable.size(); ++i)
+            expect(haveSamePhrases(patchedTable, i, fullTable, i), "Patched table compiles the same phonemes");
+
+        expect(patchedTable.isPatchOf(previousTable.getRevision()), "Patched table knows its base");
+        expect(!fullTable.isPatchOf(previousTable.getRevision()), "Table compiled from scratch has no base");
+
+        // The phrases outside of the edit are found again after remapping
+        for (size_t i = 0; i < previous.size(); ++i) {
+            if (i >= patch.firstPhrase && i < patch.firstPhrase + patch.numRemoved)
+                continue;
+
+            const size_t remapped{ patchedTable.remapPhraseIndex(previousTable.getRevision(), i) };
+            expect(remapped < patchedTable.size(), "Remapped index is within the table");
+            expect(remapped < patchedTable.size() && haveSamePhrases(previousTable, i, patchedTable, remapped),
+                   "Remapped index points to the same phrase");
+        }
+    }
+}
+
+void testChainedPatches()
+{
+    const auto inventory{ engine::PhonemeInventory::createDefault() };
+
+    Lyrics first{ inventory };
+    first.parse(std::string_view{ "la ma do re mi fa so" });
+
+    PhraseTable firstTable{ inventory };
+    firstTable.compile(first);
+
+    // Insert a word at the start, then delete one before the position
+    Lyrics second{ inventory };
+    Lyrics::Patch secondPatch{};
+    Lyrics::Edit secondEdit{};
+    secondEdit.insert(0, 3);
+    second.parse(first, std::string_view{ "ti la ma do re mi fa so" }, secondEdit, secondPatch);
+
+    PhraseTable secondTable{ inventory };
+    secondTable.compile(firstTable, second, secondPatch);
+
+    Lyrics third{ inventory };
+    Lyrics::Patch thirdPatch{};
+    Lyrics::Edit thirdEdit{};
+    thirdEdit.remove(9, 12);
+    third.parse(second, std::string_view{ "ti la ma re mi fa so" }, thirdEdit, thirdPatch);
+
+    PhraseTable thirdTable{ inventory };
+    thirdTable.compile(secondTable, third, thirdPatch);
+
+    expect(thirdTable.isPatchOf(secondTable.getRevision()), "Table is a patch of the previous one");
+    expect(thirdTable.isPatchOf(firstTable.getRevision()), "Table is a patch of the one before the previous one");
+
+    // "fa" and "so" move one phrase forward, then back
+    expect(thirdTable.remapPhraseIndex(firstTable.getRevision(), 5) == 5, "Index gets remapped through both edits");
+    expect(thirdTable.remapPhraseIndex(secondTable.getRevision(), 6) == 5, "Index gets remapped through the last edit");
+    expect(thirdTable.remapPhraseIndex(firstTable.getRevision(), 6) == 6, "Last index gets remapped through both edits");
+
+    // Only the most recent edits are kept track of
+    auto table{ std::make_shared<PhraseTable>(inventory) };
+    table->compile(first);
+    const uint32 oldestRevision{ table->getRevision() };
+
+    for (size_t i = 0; i < PhraseTable::maxBasePatches + 1; ++i) {
+        auto next{ std::make_shared<PhraseTable>(inventory) };
+        next->compile(*table, first, Lyrics::Patch{});
+        table = next;
+    }
+
+    expect(!table->isPatchOf(oldestRevision), "Tables forget the edits past the limit");
+}
+
+void testPositionKeptAcrossPendingEdits()
+{
+    constexpr int blockSize{ 512 };
+
+    engine::Engine engine{};
+    engine.prepareToPlay(44100.0f, blockSize);
+    engine.setLyrics("la ma do re mi fa so");
+
+    std::vector<float> left((size_t)blockSize);
+    std::vector<float> right((size_t)blockSize);
+
+    engine.process(left.data(), right.data(), 0);
+    engine.seekPhrase(5);
+    engine.process(left.data(), right.data(), 0);
+
+    expect(engine.getCurrentPhraseIndex() == 5, "Engine seeks to the phrase");
+
+    // Both edits reach the audio thread before the next block
+    Lyrics::Edit insertEdit{};
+    insertEdit.insert(0, 3);
+    expect(engine.updateLyrics("ti la ma do re mi fa so", insertEdit).wasOk(), "First edit is sent");
+
+    Lyrics::Edit removeEdit{};
+    removeEdit.remove(9, 12);
+    expect(engine.updateLyrics("ti la ma re mi fa so", removeEdit).wasOk(), "Second edit is sent");
+
+    engine.process(left.data(), right.data(), 0);
+
+    expect(engine.getNumPhrases() == 7, "Engine adopts the last edit");
+    expect(engine.getCurrentPhraseIndex() == 5, "Engine keeps the position across both edits");
+
+    engine.performHousekeeping();
+}
+
+void testInventorySymbols()
+{
+    engine::PhonemeInventory inventory{};
+    const engine::PhonemeInventory::ControlPoint cp{ 0.5f, 0.5f, 0.5f, 0.5f, 0.6f };
+
+    // The lyrics split the words on these, such symbols would never match
+    for (const char* symbol : { "@", "a:", "{", "a1", "a-b", "a b", "a.", "'" })
+        expect(inventory.add(symbol, cp).failed(), "Symbols with ASCII non-letters are rejected");
+
+    expect(inventory.size() == 1, "Rejected symbols are not added");
+
+    expect(inventory.add("SH", cp).wasOk(), "ASCII letters are accepted");
+    expect(inventory.add(String::fromUTF8("\xc3\x89"), cp).wasOk(), "Non-ASCII letters are accepted");
+    expect(inventory.add(String::fromUTF8("\xc3\xa9"), cp).wasOk(), "Non-ASCII letters keep their case");
+    expect(inventory.size() == 4, "Symbols differing in non-ASCII case are distinct");
+
+    const auto json{ R"({ "phonemes": [ { "symbol": "a", "tenseness": 0.6 }, { "symbol": "a:", "tenseness": 0.6 } ] })" };
+    expect(engine::PhonemeInventory{}.loadFromJSON(json).failed(), "Loading rejects symbols with ASCII non-letters");
+
+    // The lyrics lower-case the same way as the symbols
+    auto ptr{ std::make_shared<engine::PhonemeInventory>() };
+    ptr->add("SH", cp);
+    ptr->add(String::fromUTF8("\xc3\x89"), cp);
+
+    Lyrics lyrics{ ptr };
+    lyrics.parse(String::fromUTF8("Sh-\xc3\x89 sH\xc3\xa9"));
+
+    expect(lyrics.size() == 2, "Non-ASCII symbol characters belong to the words");
+
+    if (lyrics.size() == 2) {
+        engine::PhonemeInventory::Id id{};
+
+        expect(ptr->parse(lyrics[0].attack, id) == 2 && id == 1, "Upper-case ASCII lyrics match the symbol");
+        expect(ptr->parse(lyrics[0].release, id) == 2 && id == 2, "Non-ASCII lyrics match the symbol of the same case");
+        expect(ptr->parse(lyrics[1].attack, id) == 2 && id == 1, "Mixed-case ASCII lyrics match the symbol");
+        expect(lyrics[1].attack.size() == 2, "Non-ASCII characters of another case separate the words");
+    }
+}
+
+void testWorkerPool()
+{
+    constexpr size_t maxJobs{ 64 };
+    constexpr int numRuns{ 20000 };
+
+    engine::WorkerPool pool{};
+    std::array<std::atomic<int>, maxJobs> executions{};
+    std::atomic<bool> validWorker{ true };
+
+    for (size_t numThreads : { 1u, 3u, 7u }) {
+        pool.resize(numThreads);
+        expect(pool.getNumWorkers() == numThreads + 1, "Pool counts the calling thread as a worker");
+
+        bool exactlyOnce{ true };
+
+        for (int r = 0; r < numRuns; ++r) {
+            // Vary the number of jobs, so that some workers get nothing to do
+            const size_t numJobs{ (size_t)r % (maxJobs + 1) };
+
+            for (auto& count : executions)
+                count.store(0, std::memory_order_relaxed);
+
+            pool.run(numJobs, [&](size_t job, size_t worker) {
+                executions[job].fetch_add(1, std::memory_order_relaxed);
+
+                // Give the other workers a chance to claim jobs, even on a single core
+                std::this_thread::yield();
+
+                if (worker >= pool.getNumWorkers())
+                    validWorker = false;
+            });
+
+            // run() returns once all the jobs are done, their effects must be visible
+            for (size_t i = 0; i < maxJobs; ++i)
+                exactlyOnce = exactlyOnce && executions[i].load(std::memory_order_relaxed) == (i < numJobs ? 1 : 0);
+        }
+
+        expect(exactlyOnce, "Every job runs exactly once in every run");
+    }
+
+    expect(validWorker, "Jobs get valid worker indices");
+
+    pool.resize(0);
+
+    int numExecuted{};
+    pool.run(10, [&](size_t, size_t worker) { numExecuted += worker == 0 ? 1 : 0; });
+    expect(numExecuted == 10, "Pool without threads runs the jobs on the calling thread");
+}
+
+} // namespace
+
+int main()
+{
+    testIncrementalLyrics();
+    testChainedPatches();
+    testPositionKeptAcrossPendingEdits();
+    testInventorySymbols();
+    testWorkerPool();
+
+    if (failures != 0) {
+        std::printf("%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("All engine tests passed\n");
+    return EXIT_SUCCESS;
+}